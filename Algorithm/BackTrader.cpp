@@ -4,6 +4,7 @@
 #include "JLib/Arena.h"
 #include "JLib/ArrayUtils.h"
 #include "JLib/VectorUtils.h"
+#include "Random.h"
 
 namespace jv::bt
 {
@@ -40,7 +41,8 @@ namespace jv::bt
 			auto portfolio = CreatePortfolio(arena, *this);
 			
 			portfolio.liquidity = testInfo.liquidity;
-			runInfo.offset = testInfo.length + rand() % testInfo.maxOffset;
+			// Drawn from GetRandom, which the genetic algorithm seeds per instance so that ratings can be repeated.
+			runInfo.offset = testInfo.length + ai::RandU(ai::GetRandom(), testInfo.maxOffset);
 			runInfo.length = testInfo.length;
 
 			const auto endPortfolio = Run(arena, tempArena, portfolio, log, runInfo);
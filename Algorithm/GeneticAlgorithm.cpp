@@ -1,11 +1,16 @@
 #include "pch.h"
 #include "GeneticAlgorithm.h"
-#include <JLib/LinearSort.h>
 #include <NNetUtils.h>
 #include <Shader.h>
 #include <Mesh.h>
 #include <Renderer.h>
 #include <Jlib/VectorUtils.h>
+#include "Jlib/Math.h"
+#include "Random.h"
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <string>
 
 namespace jv::ai
 {
@@ -30,6 +35,286 @@ namespace jv::ai
 		return a > b;
 	}
 
+	// Shared by all threads that rate a generation.
+	struct RatingJob final
+	{
+		GeneticAlgorithmRunInfo* info;
+		NNet* generation;
+		float* ratings;
+		// Instances that have to be rated.
+		uint32_t* instances;
+		uint32_t count;
+		// Drawn by the calling thread every epoch. Every instance is rated with a generator seeded from this and its index.
+		uint64_t seed;
+		std::atomic<uint32_t> next;
+	};
+
+	// Ratings of the instances of one generation by hash, with the amount of times they were rated.
+	struct RatingCache final
+	{
+		uint64_t* keys;
+		float* ratings;
+		uint32_t* samples;
+		uint32_t mask;
+	};
+
+	static RatingCache CreateRatingCache(const uint32_t width, Arena& arena)
+	{
+		// Keep the table at most half full, so that probes stay short.
+		uint32_t size = 16;
+		while (size < width * 2)
+			size *= 2;
+
+		RatingCache cache{};
+		cache.keys = arena.New<uint64_t>(size);
+		cache.ratings = arena.New<float>(size);
+		cache.samples = arena.New<uint32_t>(size);
+		cache.mask = size - 1;
+		memset(cache.keys, 0xff, sizeof(uint64_t) * size);
+		return cache;
+	}
+
+	// Returns the slot of the key, or the empty slot where it should be added. Empty slots are UINT64_MAX.
+	[[nodiscard]] static uint32_t FindSlot(const RatingCache& cache, const uint64_t key)
+	{
+		uint32_t slot = static_cast<uint32_t>(key) & cache.mask;
+		while (cache.keys[slot] != UINT64_MAX && cache.keys[slot] != key)
+			slot = (slot + 1) & cache.mask;
+		return slot;
+	}
+
+	// Copy a signature so that it outlives its network.
+	static Signature CopySignature(const Signature& signature, Arena& arena)
+	{
+		Signature copy = signature;
+		copy.scope = arena.CreateScope();
+		copy.ids = arena.New<uint32_t>(signature.count);
+		copy.values = arena.New<float>(signature.count);
+		memcpy(copy.ids, signature.ids, sizeof(uint32_t) * signature.count);
+		memcpy(copy.values, signature.values, sizeof(float) * signature.count);
+		return copy;
+	}
+
+	// "GACP" when read as bytes.
+	constexpr uint32_t GA_CHECKPOINT_MAGIC = 0x50434147;
+	constexpr uint32_t GA_CHECKPOINT_VERSION = 1;
+
+	/*
+	Start of a checkpoint file, with everything that is carried over between epochs apart from the arrays.
+	It's followed by the current generation, the best nnet, the cached survivor compabilities, the species representatives
+	and the rating cache of the previous generation. The next generation is empty between epochs, so it isn't stored.
+	*/
+	struct CheckpointHeader final
+	{
+		uint32_t magic;
+		uint32_t version;
+		// Settings that determine the layout of the file. These have to match the run that resumes it.
+		uint32_t inputSize;
+		uint32_t outputSize;
+		uint32_t width;
+		uint32_t survivors;
+		uint32_t ratingCacheSize;
+		// Epoch to continue with.
+		uint32_t epoch;
+		uint32_t mutationId;
+		uint32_t stagnateStreak;
+		float survivorRating;
+		float bestNNetRating;
+		uint32_t hasBest;
+		uint32_t cachedCount;
+		uint32_t speciesCount;
+		Mutations currentMutations;
+		Random random;
+	};
+
+	// State of the algorithm that lives in arrays. Pairs alternate between epochs, so the epoch decides which one is used.
+	struct CheckpointData final
+	{
+		NNet** generations;
+		Arena* generationArenas;
+		NNet* bestNNet;
+		Arena* arena;
+		float* survivorCompabilities;
+		Signature** representatives;
+		Arena* speciesArenas;
+		RatingCache* ratingCaches;
+	};
+
+	static CheckpointHeader CreateCheckpointHeader(const GeneticAlgorithmRunInfo& info, const uint32_t ratingCacheSize)
+	{
+		CheckpointHeader header{};
+		header.magic = GA_CHECKPOINT_MAGIC;
+		header.version = GA_CHECKPOINT_VERSION;
+		header.inputSize = info.inputSize;
+		header.outputSize = info.outputSize;
+		header.width = info.width;
+		header.survivors = info.survivors;
+		header.ratingCacheSize = ratingCacheSize;
+		return header;
+	}
+
+	template <typename T>
+	static void Write(std::ostream& stream, const T* data, const uint64_t count)
+	{
+		stream.write(reinterpret_cast<const char*>(data), sizeof(T) * count);
+	}
+
+	template <typename T>
+	static void Read(std::istream& stream, T* data, const uint64_t count)
+	{
+		stream.read(reinterpret_cast<char*>(data), sizeof(T) * count);
+	}
+
+	static bool SaveCheckpoint(const char* path, const CheckpointHeader& header, const CheckpointData& data)
+	{
+		const uint32_t oInd = header.epoch % 2;
+		const uint32_t nInd = 1 - oInd;
+
+		// Written next to the previous checkpoint first, so that being stopped halfway doesn't destroy it.
+		const std::string tempPath = std::string(path) + ".tmp";
+		{
+			std::ofstream fout(tempPath, std::ios::binary | std::ios::trunc);
+			if (!fout.good())
+				return false;
+
+			Write(fout, &header, 1);
+			for (uint32_t i = 0; i < header.width; i++)
+			{
+				// Neuron values carry over between epochs, and the cone decides which of them are propagated.
+				const NNet& nnet = data.generations[oInd][i];
+				const uint32_t coneValid = nnet.coneValid;
+				WriteNNet(fout, nnet);
+				Write(fout, &coneValid, 1);
+				Write(fout, nnet.state.values, nnet.neuronCount);
+			}
+			if (header.hasBest)
+				WriteNNet(fout, *data.bestNNet);
+			Write(fout, data.survivorCompabilities, header.cachedCount > 0 ? static_cast<uint64_t>(header.survivors) * header.survivors : 0);
+			for (uint32_t i = 0; i < header.speciesCount; i++)
+			{
+				const auto& representative = data.representatives[nInd][i];
+				Write(fout, &representative.count, 1);
+				Write(fout, representative.ids, representative.count);
+				Write(fout, representative.values, representative.count);
+			}
+			const auto& cache = data.ratingCaches[nInd];
+			Write(fout, cache.keys, header.ratingCacheSize);
+			Write(fout, cache.ratings, header.ratingCacheSize);
+			Write(fout, cache.samples, header.ratingCacheSize);
+			if (!fout.good())
+				return false;
+		}
+		return MoveFileExA(tempPath.c_str(), path, MOVEFILE_REPLACE_EXISTING) != 0;
+	}
+
+	// Reads into the arrays of data, which can be left partially filled if the checkpoint is invalid.
+	static bool ReadCheckpoint(std::istream& stream, const uint64_t fileSize, CheckpointHeader& header, const CheckpointData& data)
+	{
+		const CheckpointHeader expected = header;
+		Read(stream, &header, 1);
+		if (!stream.good() || header.magic != expected.magic || header.version != expected.version)
+			return false;
+		if (header.inputSize != expected.inputSize || header.outputSize != expected.outputSize ||
+			header.width != expected.width || header.survivors != expected.survivors || header.ratingCacheSize != expected.ratingCacheSize)
+			return false;
+		if (header.cachedCount > header.survivors || header.speciesCount > header.width)
+			return false;
+		// The diversity mode and cacheSurvivorCompabilities decide whether there is room for cached compabilities.
+		if (header.cachedCount > 0 && !data.survivorCompabilities)
+			return false;
+
+		const uint32_t oInd = header.epoch % 2;
+		const uint32_t nInd = 1 - oInd;
+
+		for (uint32_t i = 0; i < header.width; i++)
+		{
+			NNet& nnet = data.generations[oInd][i];
+			nnet = ReadNNet(stream, data.generationArenas[oInd]);
+			if (!nnet.neurons)
+				return false;
+			uint32_t coneValid;
+			Read(stream, &coneValid, 1);
+			Read(stream, nnet.state.values, nnet.neuronCount);
+			if (coneValid)
+				UpdateCone(nnet);
+		}
+		if (header.hasBest)
+		{
+			*data.bestNNet = ReadNNet(stream, *data.arena);
+			if (!data.bestNNet->neurons)
+				return false;
+		}
+		Read(stream, data.survivorCompabilities, header.cachedCount > 0 ? static_cast<uint64_t>(header.survivors) * header.survivors : 0);
+		for (uint32_t i = 0; i < header.speciesCount; i++)
+		{
+			auto& representative = data.representatives[nInd][i];
+			Read(stream, &representative.count, 1);
+			// Don't trust the count before allocating for it.
+			const uint64_t position = stream.tellg();
+			if (!stream.good() || (fileSize - position) / (sizeof(uint32_t) + sizeof(float)) < representative.count)
+				return false;
+			auto& speciesArena = data.speciesArenas[nInd];
+			representative.scope = speciesArena.CreateScope();
+			representative.ids = speciesArena.New<uint32_t>(representative.count);
+			representative.values = speciesArena.New<float>(representative.count);
+			Read(stream, representative.ids, representative.count);
+			Read(stream, representative.values, representative.count);
+		}
+		const auto& cache = data.ratingCaches[nInd];
+		Read(stream, cache.keys, header.ratingCacheSize);
+		Read(stream, cache.ratings, header.ratingCacheSize);
+		Read(stream, cache.samples, header.ratingCacheSize);
+		return stream.good();
+	}
+
+	/*
+	Header has to hold the layout of the current run, and is replaced by the one in the file.
+	Returns false if there is no usable checkpoint, in which case nothing is loaded.
+	*/
+	static bool LoadCheckpoint(const char* path, CheckpointHeader& header, const CheckpointData& data)
+	{
+		std::ifstream fin(path, std::ios::binary);
+		if (!fin.good())
+			return false;
+		fin.seekg(0, std::ios::end);
+		const uint64_t fileSize = fin.tellg();
+		fin.seekg(0);
+
+		const CheckpointHeader expected = header;
+		const auto scope = data.arena->CreateScope();
+		if (ReadCheckpoint(fin, fileSize, header, data))
+			return true;
+
+		header = expected;
+		*data.bestNNet = {};
+		data.arena->DestroyScope(scope);
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			data.generationArenas[i].Clear();
+			data.speciesArenas[i].Clear();
+		}
+		return false;
+	}
+
+	/*
+	Rate instances until none are left. They are handed out one at a time, since rating times can differ a lot.
+	Which thread rates which instance is up to chance, so every instance gets its own generator through GetRandom.
+	The generator of the thread is restored afterwards, since the calling thread keeps using it.
+	*/
+	static void RateInstances(RatingJob& job, Arena& arena, Arena& tempArena)
+	{
+		Random& random = GetRandom();
+		const Random threadRandom = random;
+		uint32_t i;
+		while ((i = job.next++) < job.count)
+		{
+			const uint32_t id = job.instances[i];
+			random = CreateRandom(job.seed + id);
+			job.ratings[id] = job.info->ratingFunc(job.generation[id], job.info->userPtr, arena, tempArena);
+		}
+		random = threadRandom;
+	}
+
 	NNet RunGeneticAlgorithm(GeneticAlgorithmRunInfo& info, Arena& arena, Arena& tempArena)
 	{
 		gr::Renderer renderer;
@@ -45,6 +330,35 @@ namespace jv::ai
 		float* ratings = tempArena.New<float>(info.width);
 		float* compabilities = tempArena.New<float>(info.width);
 		uint32_t* indices = tempArena.New<uint32_t>(info.width);
+		// Instances that aren't rated again are looked up in the cache of the previous generation.
+		uint32_t* unrated = tempArena.New<uint32_t>(info.width);
+		uint64_t* hashes = tempArena.New<uint64_t>(info.width);
+		RatingCache ratingCaches[2]{};
+		if (info.ratingSamples > 0)
+			for (auto& cache : ratingCaches)
+				cache = CreateRatingCache(info.width, tempArena);
+		Signature* signatures = tempArena.New<Signature>(info.width);
+		const bool pairwise = info.diversityMode == DiversityMode::pairwise;
+		// Compability of every pair in the current generation, and of the survivors that were taken from it.
+		// Survivors are passed on unchanged unless they are pruned, so their pairs don't have to be compared again.
+		const bool cachePairs = pairwise && info.cacheSurvivorCompabilities;
+		const size_t pairCount = cachePairs ? static_cast<size_t>(info.width) * info.width : 0;
+		const size_t survivorPairCount = cachePairs ? static_cast<size_t>(info.survivors) * info.survivors : 0;
+		// Arena allocations are limited to 32 bit sizes.
+		assert(pairCount * sizeof(float) <= UINT32_MAX);
+		float* pairCompabilities = cachePairs ? tempArena.New<float>(pairCount) : nullptr;
+		float* survivorCompabilities = cachePairs ? tempArena.New<float>(survivorPairCount) : nullptr;
+		uint32_t cachedCount = 0;
+
+		// Species of the previous epoch, represented by a copy of the signature of their first member.
+		Signature* representatives[2];
+		representatives[0] = tempArena.New<Signature>(info.width);
+		representatives[1] = tempArena.New<Signature>(info.width);
+		// Indexed by species. The old species are kept until the end of the epoch, and every instance can start a new one.
+		uint32_t* speciesSizes = tempArena.New<uint32_t>(info.width * 2);
+		uint32_t* firstMembers = tempArena.New<uint32_t>(info.width * 2);
+		uint32_t* speciesIds = tempArena.New<uint32_t>(info.width);
+		uint32_t speciesCount = 0;
 		
 		float bestNNetRating = -1;
 		NNet bestNNet{};
@@ -60,11 +374,31 @@ namespace jv::ai
 		arenaCreateInfo.memory = tempArena.Alloc(info.initMemSize / 2);
 		arenas[1] = Arena::Create(arenaCreateInfo);
 
+		// Representatives are read from one arena while the next ones are written to the other.
+		Arena speciesArenas[2];
+		arenaCreateInfo.memory = nullptr;
+		arenaCreateInfo.memorySize = info.initMemSize / 16;
+		speciesArenas[0] = Arena::Create(arenaCreateInfo);
+		speciesArenas[1] = Arena::Create(arenaCreateInfo);
+
+		// The calling thread uses the arenas that are passed in, every other thread gets a pair of its own.
+		const uint32_t threadCount = info.threadCount > 0 ? info.threadCount : Max(std::thread::hardware_concurrency(), 1u);
+		std::thread* threads = tempArena.New<std::thread>(threadCount - 1);
+		Arena* threadArenas = tempArena.New<Arena>((threadCount - 1) * 2);
+		arenaCreateInfo.memorySize = info.threadMemSize;
+		for (uint32_t i = 0; i < (threadCount - 1) * 2; i++)
+			threadArenas[i] = Arena::Create(arenaCreateInfo);
+
 		jv::ai::Mutations currentMutations = info.mutations;
 
 		NNet* generations[2];
+		// Lineage record of every instance.
+		uint32_t* recordIds[2];
 		for (uint32_t i = 0; i < 2; i++)
+		{
 			generations[i] = tempArena.New<NNet>(info.width);
+			recordIds[i] = tempArena.New<uint32_t>(info.width);
+		}
 
 		uint32_t mutationId = 0;
 
@@ -78,8 +412,48 @@ namespace jv::ai
 		nnetCreateInfo.neuronCapacity += info.arrivalMutationCount;
 		nnetCreateInfo.weightCapacity += info.arrivalMutationCount * 3;
 
+		// Scope used to store best nnet in.
+		auto retScope = arena.CreateScope();
+
+		uint32_t stagnateStreak = 0;
+		float survivorRating = 0;
+		float previousSurvivorRating;
+
+		CheckpointData checkpointData{};
+		checkpointData.generations = generations;
+		checkpointData.generationArenas = arenas;
+		checkpointData.bestNNet = &bestNNet;
+		checkpointData.arena = &arena;
+		checkpointData.survivorCompabilities = survivorCompabilities;
+		checkpointData.representatives = representatives;
+		checkpointData.speciesArenas = speciesArenas;
+		checkpointData.ratingCaches = ratingCaches;
+		const uint32_t ratingCacheSize = info.ratingSamples > 0 ? ratingCaches[0].mask + 1 : 0;
+
+		// Continue from the last checkpoint if there is one.
+		auto checkpoint = CreateCheckpointHeader(info, ratingCacheSize);
+		const bool resumed = info.checkpointPath && LoadCheckpoint(info.checkpointPath, checkpoint, checkpointData);
+		const uint32_t firstEpoch = resumed ? checkpoint.epoch : 0;
+		if (resumed)
+		{
+			mutationId = checkpoint.mutationId;
+			currentMutations = checkpoint.currentMutations;
+			stagnateStreak = checkpoint.stagnateStreak;
+			survivorRating = checkpoint.survivorRating;
+			bestNNetRating = checkpoint.bestNNetRating;
+			cachedCount = checkpoint.cachedCount;
+			speciesCount = checkpoint.speciesCount;
+			GetRandom() = checkpoint.random;
+
+			const uint32_t oInd = firstEpoch % 2;
+			for (uint32_t i = 0; i < info.width && info.lineage; i++)
+				recordIds[oInd][i] = Record(*info.lineage, generations[oInd][i], firstEpoch);
+			if (info.debug)
+				std::cout << "Resuming from epoch " << firstEpoch << std::endl;
+		}
+
 		// Set up first generation of random instances.
-		for (uint32_t i = 0; i < info.width; i++)
+		for (uint32_t i = 0; i < info.width && !resumed; i++)
 		{
 			NNet& nnet = generations[0][i];
 			nnet = CreateNNet(nnetCreateInfo, arenas[0]);
@@ -88,19 +462,15 @@ namespace jv::ai
 
 			for (uint32_t j = 0; j < info.arrivalMutationCount; j++)
 				Mutate(nnet, currentMutations, mutationId);
+			if (info.lineage)
+				recordIds[0][i] = Record(*info.lineage, nnet, 0);
 		}
 
-		// Scope used to store best nnet in.
-		auto retScope = arena.CreateScope();
-
-		uint32_t stagnateStreak = 0;
-		float survivorRating = 0;
-		float previousSurvivorRating;
-
 		auto epochDebugData = CreateVector<EpochDebugData>(tempArena, info.epochs);
 
-		for (uint32_t i = 0; i < info.epochs; i++)
+		for (uint32_t i = firstEpoch; i < info.epochs; i++)
 		{
+			bool closed = false;
 			if (info.debug)
 			{
 				renderer.DrawPlane(glm::vec2(0), glm::vec2(1 * renderer.GetAspectRatio(), 1), glm::vec4(1));
@@ -122,10 +492,29 @@ namespace jv::ai
 					renderer.DrawLine(glm::vec2(xStart, prev.filtered / bestNNetRating - 1), glm::vec2(xEnd, cur.filtered / bestNNetRating - 1), glm::vec4(0, 0, 1, 1));
 				}
 				
-				const bool result = renderer.Render();
-				if (result)
-					break;
+				closed = renderer.Render();
+			}
+
+			// Only the current generation is alive in between epochs, which makes this the place to take a checkpoint.
+			const bool checkpointDue = info.checkpointInterval > 0 && i > firstEpoch && i % info.checkpointInterval == 0;
+			if (info.checkpointPath && (closed || checkpointDue))
+			{
+				checkpoint.epoch = i;
+				checkpoint.mutationId = mutationId;
+				checkpoint.stagnateStreak = stagnateStreak;
+				checkpoint.survivorRating = survivorRating;
+				checkpoint.bestNNetRating = bestNNetRating;
+				checkpoint.hasBest = bestNNet.neurons != nullptr;
+				checkpoint.cachedCount = cachedCount;
+				checkpoint.speciesCount = speciesCount;
+				checkpoint.currentMutations = currentMutations;
+				checkpoint.random = GetRandom();
+				const bool saved = SaveCheckpoint(info.checkpointPath, checkpoint, checkpointData);
+				if (info.debug && !saved)
+					std::cout << "Unable to save checkpoint to " << info.checkpointPath << std::endl;
 			}
+			if (closed)
+				break;
 
 			previousSurvivorRating = survivorRating;
 			survivorRating = 0;
@@ -136,28 +525,142 @@ namespace jv::ai
 			uint32_t nInd = 1 - oInd;
 
 			for (uint32_t j = 0; j < info.width; j++)
+			{
 				compabilities[j] = 0;
+				signatures[j] = CreateSignature(generations[oInd][j], arenas[oInd]);
+			}
 
 			float bestRatingUnfiltered = -1;
 			uint32_t bestRatingUnfilteredIndex = -1;
 
-			// Rate every instance of the generation.
+			// Rate every instance of the generation, except the ones that have been rated enough already.
+			RatingJob job{};
+			job.info = &info;
+			job.generation = generations[oInd];
+			job.ratings = ratings;
+			job.instances = unrated;
+			job.seed = NextRandom(GetRandom());
+			job.next = 0;
 			for (uint32_t j = 0; j < info.width; j++)
 			{
-				NNet& nnet = generations[oInd][j];
-				ratings[j] = info.ratingFunc(nnet, info.userPtr, arena, tempArena);
+				if (info.ratingSamples > 0)
+				{
+					const auto& cache = ratingCaches[nInd];
+					hashes[j] = GetHash(generations[oInd][j]);
+					const uint32_t slot = FindSlot(cache, hashes[j]);
+					if (cache.keys[slot] != UINT64_MAX && cache.samples[slot] >= info.ratingSamples)
+						continue;
+				}
+				unrated[job.count++] = j;
+			}
+			for (uint32_t j = 0; j < threadCount - 1; j++)
+				threads[j] = std::thread(RateInstances, std::ref(job), std::ref(threadArenas[j * 2]), std::ref(threadArenas[j * 2 + 1]));
+			RateInstances(job, arena, tempArena);
+			for (uint32_t j = 0; j < threadCount - 1; j++)
+				threads[j].join();
+
+			// Average the new ratings with the ones of earlier generations, and pass them on to the next.
+			if (info.ratingSamples > 0)
+			{
+				const auto& previous = ratingCaches[nInd];
+				auto& current = ratingCaches[oInd];
+				memset(current.keys, 0xff, sizeof(uint64_t) * (current.mask + 1));
+
+				uint32_t k = 0;
+				for (uint32_t j = 0; j < info.width; j++)
+				{
+					const bool rated = k < job.count && unrated[k] == j;
+					k += rated;
+
+					const uint32_t previousSlot = FindSlot(previous, hashes[j]);
+					const bool found = previous.keys[previousSlot] != UINT64_MAX;
+					const uint32_t samples = found ? previous.samples[previousSlot] : 0;
+					if (found && !rated)
+						ratings[j] = previous.ratings[previousSlot];
+					else if (found)
+						ratings[j] = (previous.ratings[previousSlot] * samples + ratings[j]) / (samples + 1);
+
+					// Copies within the same generation share their slot.
+					const uint32_t slot = FindSlot(current, hashes[j]);
+					if (current.keys[slot] != UINT64_MAX)
+					{
+						ratings[j] = current.ratings[slot];
+						continue;
+					}
+					current.keys[slot] = hashes[j];
+					current.ratings[slot] = ratings[j];
+					current.samples[slot] = samples + rated;
+				}
+			}
 
-				// Set best current rating if it's the best of this generation.
+			// Set best current rating if it's the best of this generation.
+			for (uint32_t j = 0; j < info.width; j++)
 				if (Comparer(ratings[j], bestRatingUnfiltered))
 				{
 					bestRatingUnfilteredIndex = j;
 					bestRatingUnfiltered = ratings[j];
 				}
 
+			if (!pairwise)
+			{
+				const Signature* previous = representatives[nInd];
+				uint32_t count = speciesCount;
+				for (uint32_t j = 0; j < count; j++)
+				{
+					speciesSizes[j] = 0;
+					firstMembers[j] = UINT32_MAX;
+				}
+
+				// Join the first species that is compatible enough, or start a new one.
+				for (uint32_t j = 0; j < info.width; j++)
+				{
+					uint32_t species = 0;
+					for (; species < count; species++)
+					{
+						const auto& representative = species < speciesCount ? previous[species] : signatures[firstMembers[species]];
+						if (GetCompability(signatures[j], representative, info.compabilityWeightFactor) >= info.speciesThreshold)
+							break;
+					}
+					if (species == count)
+					{
+						assert(count < info.width * 2);
+						speciesSizes[count] = 0;
+						firstMembers[count++] = j;
+					}
+					firstMembers[species] = Min(firstMembers[species], j);
+					++speciesSizes[species];
+					speciesIds[j] = species;
+				}
+
+				// Same as the pairwise mode if instances are fully compatible within a species and not at all outside of it.
+				for (uint32_t j = 0; j < info.width; j++)
+				{
+					const float c = 1.f - static_cast<float>(speciesSizes[speciesIds[j]] - 1) / (info.width - 1);
+					ratings[j] *= c;
+				}
+
+				// Species without members die out.
+				speciesArenas[oInd].Clear();
+				speciesCount = 0;
+				for (uint32_t j = 0; j < count; j++)
+					if (speciesSizes[j] > 0)
+						representatives[oInd][speciesCount++] = CopySignature(signatures[firstMembers[j]], speciesArenas[oInd]);
+			}
+
+			for (uint32_t j = 0; j < info.width && pairwise; j++)
+			{
+				// Survivors can be picked more than once, which makes them their own pair in the cache.
+				if (cachePairs)
+					pairCompabilities[static_cast<size_t>(j) * info.width + j] = 1;
 				for (uint32_t k = j + 1; k < info.width; k++)
 				{
-					NNet& oNNet = generations[oInd][k];
-					const float compability = GetCompability(nnet, oNNet);
+					const float compability = k < cachedCount ? survivorCompabilities[j * info.survivors + k] :
+						GetCompability(signatures[j], signatures[k], info.compabilityWeightFactor);
+					if (cachePairs)
+					{
+						pairCompabilities[static_cast<size_t>(j) * info.width + k] = compability;
+						pairCompabilities[static_cast<size_t>(k) * info.width + j] = compability;
+					}
 					compabilities[j] += compability;
 					compabilities[k] += compability;
 				}
@@ -171,14 +674,41 @@ namespace jv::ai
 			if (survivorRating > previousSurvivorRating)
 				stagnateStreak = 0;
 
-			CreateSortableIndices(indices, info.width);
-			ExtLinearSort(ratings, indices, info.width, Comparer);
+			// Only the survivors are needed, so the generation is never fully sorted.
+			switch (info.selectionMode)
+			{
+			case SelectionMode::tournament:
+				SelectTournament(ratings, info.width, indices, info.survivors, info.tournamentSize);
+				break;
+			case SelectionMode::rank:
+				SelectRank(ratings, info.width, indices, info.survivors, info.rankPressure);
+				break;
+			default:
+				SelectTop(ratings, info.width, indices, info.survivors);
+				break;
+			}
+
+			cachedCount = info.pruneSurvivors || !cachePairs ? 0 : info.survivors;
+			for (uint32_t j = 0; j < cachedCount; j++)
+				for (uint32_t k = 0; k < cachedCount; k++)
+					survivorCompabilities[j * info.survivors + k] =
+						pairCompabilities[static_cast<size_t>(indices[j]) * info.width + indices[k]];
 
 			const uint32_t hw = info.width / 2;
 			// Copy best performing nnets to new generation.
 			for (uint32_t j = 0; j < info.survivors; j++)
 			{
-				Copy(generations[oInd][indices[j]], generations[nInd][j], &arenas[nInd]);
+				auto& survivor = generations[oInd][indices[j]];
+				const uint32_t recordId = recordIds[oInd][indices[j]];
+				recordIds[nInd][j] = recordId;
+				if (info.pruneSurvivors)
+				{
+					generations[nInd][j] = Prune(survivor, arenas[nInd], tempArena);
+					if (info.lineage)
+						recordIds[nInd][j] = Record(*info.lineage, generations[nInd][j], i + 1, &survivor, recordId);
+				}
+				else
+					Copy(survivor, generations[nInd][j], &arenas[nInd]);
 				survivorRating += ratings[indices[j]];
 			}
 
@@ -213,25 +743,36 @@ namespace jv::ai
 			arenas[oInd].Clear();
 
 			const auto nGen = generations[nInd];
+			// Drawn from the generator of this thread instead of rand(), since its state can be stored in a checkpoint.
+			auto& random = GetRandom();
 			uint32_t breededCount = info.width - info.survivors - info.arrivals;
 
 			// Breed new generation.
 			for (uint32_t j = 0; j < breededCount; j++)
 			{
-				// No two parents for now, just copy and mutate.
-				// The issue now is that they breed from two entirely different architectures, 
-				// effectively doubling the size every time, leaving no room for small improvements.
-				/*
-				auto& a = nGen[rand() % info.survivors];
-				auto& b = nGen[rand() % info.survivors];
-				auto& c = nGen[info.survivors + j] = Breed(a, b, arenas[nInd], tempArena);
-				Mutate(c, currentMutations, mutationId);
-				*/
-
-				auto& parent = nGen[rand() % info.survivors];
 				auto& child = nGen[info.survivors + j];
-				Copy(parent, child, &arenas[nInd]);
-				Mutate(child, currentMutations, mutationId);
+				// Crossover children are recorded against their first parent.
+				const uint32_t parentIndex = RandU(random, info.survivors);
+				auto& parent = nGen[parentIndex];
+
+				// Breeding two entirely different architectures adds up their hidden structure,
+				// so it's only done some of the time. Nothing is drawn without crossover, which keeps the random sequence of those runs.
+				if (info.crossoverChance > 0 && RandF(random) < info.crossoverChance)
+				{
+					auto& b = nGen[RandU(random, info.survivors)];
+					child = Breed(parent, b, arenas[nInd], tempArena);
+				}
+				else
+				{
+					// Only the arrays that are mutated are copied.
+					Share(parent, child, arenas[nInd]);
+				}
+				Mutate(child, currentMutations, mutationId, nullptr, &arenas[nInd]);
+				if (info.lineage)
+				{
+					const uint32_t index = info.survivors + j;
+					recordIds[nInd][index] = Record(*info.lineage, child, i + 1, &parent, recordIds[nInd][parentIndex]);
+				}
 			}
 
 			// Add new random arrivals.
@@ -243,6 +784,8 @@ namespace jv::ai
 				ConnectIO(nnet, jv::ai::InitType::random, mutationId);
 				for (uint32_t j = 0; j < info.arrivalMutationCount; j++)
 					Mutate(nnet, currentMutations, mutationId);
+				if (info.lineage)
+					recordIds[nInd][info.width - j - 1] = Record(*info.lineage, nnet, i + 1);
 			}
 
 			if (info.debug)
@@ -287,6 +830,17 @@ namespace jv::ai
 				currentMutations = info.mutations;
 		}
 
+		if (info.savePath && bestNNet.neurons)
+		{
+			const bool saved = SaveNNet(info.savePath, bestNNet);
+			if (info.debug && !saved)
+				std::cout << "Unable to save to " << info.savePath << std::endl;
+		}
+
+		for (uint32_t i = 0; i < (threadCount - 1) * 2; i++)
+			Arena::Destroy(threadArenas[i]);
+		Arena::Destroy(speciesArenas[1]);
+		Arena::Destroy(speciesArenas[0]);
 		Arena::Destroy(arenas[1]);
 		Arena::Destroy(arenas[0]);
 		tempArena.DestroyScope(tempScope);
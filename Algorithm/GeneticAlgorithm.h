@@ -2,9 +2,20 @@
 #include "JLib/Arena.h"
 #include "NNet.h"
 #include "NNetUtils.h"
+#include "Lineage.h"
+#include "Selection.h"
 
 namespace jv::ai 
 {
+	// How the ratings are scaled to reward unique instances.
+	enum class DiversityMode
+	{
+		// Compare every pair of instances, which is quadratic in the width.
+		pairwise,
+		// Compare instances to one representative of every species, like NEAT. Ratings are shared within a species.
+		species
+	};
+
 	struct GeneticAlgorithmRunInfo final
 	{
 		uint32_t inputSize, outputSize;
@@ -14,6 +25,12 @@ namespace jv::ai
 		uint32_t epochs = 1000;
 		// Remaining nnets that pass unchanged to the next generation.
 		uint32_t survivors = 100;
+		// How survivors are picked. Tournament and rank selection can pick the same instance more than once.
+		SelectionMode selectionMode = SelectionMode::top;
+		// Amount of instances per tournament in tournament selection.
+		uint32_t tournamentSize = 4;
+		// Selection pressure of rank selection, between 1 and 2. See SelectRank.
+		float rankPressure = 1.5f;
 		// New instances added to each new generation.
 		uint32_t arrivals = 100;
 		// Every new instance will mutate x times to get more random initial starts.
@@ -25,12 +42,57 @@ namespace jv::ai
 		// Mutation chances are multiplied by this every unsuccesfull epoch. Resets on success.
 		float stagnationMul = .99f;
 		float stagnationMaxPctChange = .1f;
+		// Chance that a new instance is bred from two survivors instead of being a copy of one.
+		float crossoverChance = 0;
+		DiversityMode diversityMode = DiversityMode::pairwise;
+		// Minimum compability with the representative of a species to become part of it.
+		float speciesThreshold = .8f;
+		// Weight of the average weight difference when comparing instances, 0 compares structure only. See GetCompability.
+		float compabilityWeightFactor = 0;
+		/*
+		Keep the compabilities between survivors in pairwise mode, so that they aren't compared again in the next epoch.
+		This only saves the survivor pairs, but it stores every pair of a generation, which is width * width floats.
+		*/
+		bool cacheSurvivorCompabilities = false;
+		// Strip dead structure from survivors before they pass to the next generation.
+		bool pruneSurvivors = false;
+		// If set, every instance is recorded in here, so that any instance of any epoch can be reconstructed afterwards.
+		Lineage* lineage = nullptr;
+		// If set, the best nnet is written to this file when the algorithm finishes. See SaveNNet.
+		const char* savePath = nullptr;
+		/*
+		If set, the state of the run is written to this file every checkpointInterval epochs and when the debug window is closed.
+		If the file already exists, the run continues from it instead of starting over. Remove the file to start over.
+		The result is the same as that of a run that was never interrupted, as long as rating functions only draw their
+		randomness from GetRandom, see ratingFunc. The lineage isn't part of the checkpoint, so a resumed run records its
+		first generation as snapshots.
+		*/
+		const char* checkpointPath = nullptr;
+		uint32_t checkpointInterval = 10;
 		// Amount of times the nnet result is checked extra if it's a new best result.
 		uint32_t validationCheckAmount = 10;
 		// Memory reserved for the algorithm. 
 		// Will increase dynamically if there is no space, but will obviously fragment if that happens.
 		size_t initMemSize = 33554432;
+		/*
+		Has to be reentrant if threadCount isn't 1, since instances are then rated at the same time.
+		Every thread passes its own arenas, but userPtr is shared. Only the state of the nnet may be changed, which includes
+		propagating with its default state. Its neurons and weights are read only, since they can be shared with other
+		instances (see Share) and are hashed before rating.
+		While rating a generation, GetRandom returns a generator seeded from the epoch and the instance, so that ratings
+		don't depend on the thread count and are repeated exactly when resuming from a checkpoint.
+		*/
 		float (*ratingFunc)(NNet& nnet, void* userPtr, Arena& arena, Arena& tempArena);
+		/*
+		If set, instances are recognized by their hash and are only rated until they have been rated this many times.
+		After that the average rating is reused, which saves rating survivors and children that didn't change.
+		Use 1 for deterministic rating functions, and more to average out noisy ones. 0 disables the cache.
+		*/
+		uint32_t ratingSamples = 0;
+		// Amount of threads used to rate a generation, including the calling thread. 0 uses one per core.
+		uint32_t threadCount = 1;
+		// Initial size of the arenas of every extra rating thread.
+		uint32_t threadMemSize = 4194304;
 		// Will stop the algorithm if the target score is met.
 		float targetScore = -1;
 		void* userPtr;
@@ -0,0 +1,197 @@
+#include "pch.h"
+#include "Lineage.h"
+#include "Jlib/Math.h"
+
+namespace jv::ai
+{
+	Lineage CreateLineage(const LineageCreateInfo& info, Arena& arena)
+	{
+		Lineage lineage{};
+		lineage.info = info;
+		lineage.arena = &arena;
+		lineage.scope = arena.CreateScope();
+		lineage.blockCapacity = 16;
+		lineage.blocks = arena.New<LineageRecord*>(lineage.blockCapacity);
+		return lineage;
+	}
+
+	void DestroyLineage(Lineage& lineage)
+	{
+		lineage.arena->DestroyScope(lineage.scope);
+		lineage = {};
+	}
+
+	// Neurons and weights are compared bitwise. WeightMeta is compared by member since it contains padding.
+	[[nodiscard]] static bool IsNeuronChanged(const NNet& nnet, const NNet& parent, const uint32_t neuronId)
+	{
+		if (neuronId >= parent.neuronCount)
+			return true;
+		return memcmp(&nnet.neurons[neuronId], &parent.neurons[neuronId], sizeof(Neuron)) != 0 ||
+			nnet.neuronMeta[neuronId].innovationId != parent.neuronMeta[neuronId].innovationId;
+	}
+
+	[[nodiscard]] static bool IsWeightChanged(const NNet& nnet, const NNet& parent, const uint32_t weightId)
+	{
+		if (weightId >= parent.weightCount)
+			return true;
+		const auto& meta = nnet.weightMeta[weightId];
+		const auto& parentMeta = parent.weightMeta[weightId];
+		return memcmp(&nnet.weights[weightId], &parent.weights[weightId], sizeof(Weight)) != 0 ||
+			meta.innovationId != parentMeta.innovationId || meta.from != parentMeta.from || meta.enabled != parentMeta.enabled;
+	}
+
+	static LineageRecord& AddRecord(Lineage& lineage)
+	{
+		Arena& arena = *lineage.arena;
+		if (lineage.count == lineage.blockCount * LINEAGE_BLOCK_SIZE)
+		{
+			// The old table is left behind in the arena, it's small compared to the records.
+			if (lineage.blockCount == lineage.blockCapacity)
+			{
+				auto blocks = arena.New<LineageRecord*>(lineage.blockCapacity * 2);
+				memcpy(blocks, lineage.blocks, sizeof(LineageRecord*) * lineage.blockCount);
+				lineage.blocks = blocks;
+				lineage.blockCapacity *= 2;
+			}
+			lineage.blocks[lineage.blockCount++] = arena.New<LineageRecord>(LINEAGE_BLOCK_SIZE);
+		}
+		const uint32_t id = lineage.count++;
+		return lineage.blocks[id / LINEAGE_BLOCK_SIZE][id % LINEAGE_BLOCK_SIZE] = {};
+	}
+
+	uint32_t Record(Lineage& lineage, const NNet& nnet, const uint32_t epoch, const NNet* parent, const uint32_t parentId)
+	{
+		assert(!parent == (parentId == UINT32_MAX));
+		Arena& arena = *lineage.arena;
+		uint32_t depth = parent ? GetRecord(lineage, parentId).depth + 1 : 0;
+
+		uint32_t neuronChangeCount = 0;
+		uint32_t weightChangeCount = 0;
+		bool snapshot = !parent || depth >= lineage.info.snapshotInterval;
+		if (!snapshot)
+		{
+			for (uint32_t i = 0; i < nnet.neuronCount; i++)
+				neuronChangeCount += IsNeuronChanged(nnet, *parent, i);
+			for (uint32_t i = 0; i < nnet.weightCount; i++)
+				weightChangeCount += IsWeightChanged(nnet, *parent, i);
+			// Every change also stores an index, so a diff of more than half isn't worth it.
+			snapshot = neuronChangeCount * 2 > nnet.neuronCount || weightChangeCount * 2 > nnet.weightCount;
+		}
+		if (snapshot)
+		{
+			depth = 0;
+			neuronChangeCount = nnet.neuronCount;
+			weightChangeCount = nnet.weightCount;
+		}
+
+		const uint32_t id = lineage.count;
+		auto& record = AddRecord(lineage);
+		record.parent = snapshot ? UINT32_MAX : parentId;
+		record.epoch = epoch;
+		record.depth = depth;
+		record.createInfo = nnet.createInfo;
+		record.neuronCount = nnet.neuronCount;
+		record.weightCount = nnet.weightCount;
+		record.neuronChangeCount = neuronChangeCount;
+		record.weightChangeCount = weightChangeCount;
+		record.neurons = arena.New<Neuron>(neuronChangeCount);
+		record.neuronMeta = arena.New<NeuronMeta>(neuronChangeCount);
+		record.weights = arena.New<Weight>(weightChangeCount);
+		record.weightMeta = arena.New<WeightMeta>(weightChangeCount);
+
+		if (snapshot)
+		{
+			memcpy(record.neurons, nnet.neurons, sizeof(Neuron) * nnet.neuronCount);
+			memcpy(record.neuronMeta, nnet.neuronMeta, sizeof(NeuronMeta) * nnet.neuronCount);
+			memcpy(record.weights, nnet.weights, sizeof(Weight) * nnet.weightCount);
+			memcpy(record.weightMeta, nnet.weightMeta, sizeof(WeightMeta) * nnet.weightCount);
+			return id;
+		}
+
+		record.neuronIds = arena.New<uint32_t>(neuronChangeCount);
+		record.weightIds = arena.New<uint32_t>(weightChangeCount);
+
+		uint32_t count = 0;
+		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+		{
+			if (!IsNeuronChanged(nnet, *parent, i))
+				continue;
+			record.neuronIds[count] = i;
+			record.neurons[count] = nnet.neurons[i];
+			record.neuronMeta[count++] = nnet.neuronMeta[i];
+		}
+
+		count = 0;
+		for (uint32_t i = 0; i < nnet.weightCount; i++)
+		{
+			if (!IsWeightChanged(nnet, *parent, i))
+				continue;
+			record.weightIds[count] = i;
+			record.weights[count] = nnet.weights[i];
+			record.weightMeta[count++] = nnet.weightMeta[i];
+		}
+		return id;
+	}
+
+	const LineageRecord& GetRecord(const Lineage& lineage, const uint32_t id)
+	{
+		assert(id < lineage.count);
+		return lineage.blocks[id / LINEAGE_BLOCK_SIZE][id % LINEAGE_BLOCK_SIZE];
+	}
+
+	NNet Reconstruct(const Lineage& lineage, const uint32_t id, Arena& arena, Arena& tempArena)
+	{
+		const auto tempScope = tempArena.CreateScope();
+		const auto& record = GetRecord(lineage, id);
+
+		// Walk back to the snapshot. Earlier genomes can be larger than the requested one, for instance before pruning.
+		uint32_t* path = tempArena.New<uint32_t>(record.depth + 1);
+		uint32_t neuronCapacity = 0;
+		uint32_t weightCapacity = 0;
+		uint32_t current = id;
+		for (uint32_t i = record.depth + 1; i-- > 0;)
+		{
+			const auto& step = GetRecord(lineage, current);
+			path[i] = current;
+			neuronCapacity = Max(neuronCapacity, step.neuronCount);
+			weightCapacity = Max(weightCapacity, step.weightCount);
+			current = step.parent;
+		}
+		assert(current == UINT32_MAX);
+
+		auto neurons = tempArena.New<Neuron>(neuronCapacity);
+		auto neuronMeta = tempArena.New<NeuronMeta>(neuronCapacity);
+		auto weights = tempArena.New<Weight>(weightCapacity);
+		auto weightMeta = tempArena.New<WeightMeta>(weightCapacity);
+
+		for (uint32_t i = 0; i <= record.depth; i++)
+		{
+			const auto& step = GetRecord(lineage, path[i]);
+			for (uint32_t j = 0; j < step.neuronChangeCount; j++)
+			{
+				const uint32_t neuronId = step.neuronIds ? step.neuronIds[j] : j;
+				neurons[neuronId] = step.neurons[j];
+				neuronMeta[neuronId] = step.neuronMeta[j];
+			}
+			for (uint32_t j = 0; j < step.weightChangeCount; j++)
+			{
+				const uint32_t weightId = step.weightIds ? step.weightIds[j] : j;
+				weights[weightId] = step.weights[j];
+				weightMeta[weightId] = step.weightMeta[j];
+			}
+		}
+
+		NNetCreateInfo createInfo = record.createInfo;
+		NNet nnet = CreateNNet(createInfo, arena);
+		nnet.neuronCount = record.neuronCount;
+		nnet.weightCount = record.weightCount;
+		memcpy(nnet.neurons, neurons, sizeof(Neuron) * record.neuronCount);
+		memcpy(nnet.neuronMeta, neuronMeta, sizeof(NeuronMeta) * record.neuronCount);
+		memcpy(nnet.weights, weights, sizeof(Weight) * record.weightCount);
+		memcpy(nnet.weightMeta, weightMeta, sizeof(WeightMeta) * record.weightCount);
+		UpdateEdgeIndex(nnet);
+
+		tempArena.DestroyScope(tempScope);
+		return nnet;
+	}
+}
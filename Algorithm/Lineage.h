@@ -0,0 +1,68 @@
+#pragma once
+#include "JLib/Arena.h"
+#include "NNet.h"
+
+namespace jv::ai
+{
+	// Amount of records stored per block, blocks are never moved.
+	constexpr uint32_t LINEAGE_BLOCK_SIZE = 4096;
+
+	/*
+	A genome stored as the neurons and weights that differ from its parent, or as a full snapshot.
+	Parents are always recorded before their children.
+	*/
+	struct LineageRecord final
+	{
+		// Record this one is a diff of, UINT32_MAX for a snapshot.
+		uint32_t parent;
+		uint32_t epoch;
+		// Amount of diffs between this record and its snapshot.
+		uint32_t depth;
+		NNetCreateInfo createInfo;
+		uint32_t neuronCount;
+		uint32_t weightCount;
+		uint32_t neuronChangeCount;
+		uint32_t weightChangeCount;
+		// Indices of the changed neurons and weights. Null for a snapshot, which stores everything in order.
+		uint32_t* neuronIds;
+		uint32_t* weightIds;
+		Neuron* neurons;
+		NeuronMeta* neuronMeta;
+		Weight* weights;
+		WeightMeta* weightMeta;
+	};
+
+	struct LineageCreateInfo final
+	{
+		// Maximum amount of diffs before a genome is stored as a snapshot, which bounds the cost of reconstructing it.
+		uint32_t snapshotInterval = 32;
+	};
+
+	/*
+	History of all genomes of a run, so that any genome can be reconstructed later on.
+	Records are allocated from the arena whenever they are added, so the arena should not be used for scoped allocations.
+	*/
+	struct Lineage final
+	{
+		LineageCreateInfo info;
+		Arena* arena;
+		uint64_t scope;
+		LineageRecord** blocks;
+		uint32_t blockCount;
+		uint32_t blockCapacity;
+		uint32_t count;
+	};
+
+	__declspec(dllexport) [[nodiscard]] Lineage CreateLineage(const LineageCreateInfo& info, Arena& arena);
+	__declspec(dllexport) void DestroyLineage(Lineage& lineage);
+	/*
+	Add a genome to the lineage and returns its id. If a parent is given, only the differences with it are stored.
+	The parent has to be the genome that parentId refers to, since it's used to find the differences.
+	Falls back to a snapshot if the diff would not be smaller or the diff chain gets too long.
+	*/
+	__declspec(dllexport) uint32_t Record(Lineage& lineage, const NNet& nnet, uint32_t epoch,
+		const NNet* parent = nullptr, uint32_t parentId = UINT32_MAX);
+	__declspec(dllexport) [[nodiscard]] const LineageRecord& GetRecord(const Lineage& lineage, uint32_t id);
+	// Rebuild a recorded genome by applying the diffs since its snapshot.
+	__declspec(dllexport) [[nodiscard]] NNet Reconstruct(const Lineage& lineage, uint32_t id, Arena& arena, Arena& tempArena);
+}
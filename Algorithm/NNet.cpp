@@ -1,6 +1,8 @@
 #include "pch.h"
 #include "NNet.h"
+#include "NNetKernels.h"
 #include "Jlib/Math.h"
+#include <fstream>
 
 namespace jv::ai
 {
@@ -13,6 +15,12 @@ namespace jv::ai
 		nnet.scope = arena.CreateScope();
 		nnet.neurons = arena.New<Neuron>(info.neuronCapacity);
 		nnet.weights = arena.New<Weight>(info.weightCapacity);
+		nnet.neuronMeta = arena.New<NeuronMeta>(info.neuronCapacity);
+		nnet.weightMeta = arena.New<WeightMeta>(info.weightCapacity);
+		nnet.state = CreateNNetState(nnet, arena);
+		nnet.cone = arena.New<uint32_t>(info.neuronCapacity);
+		CreateEdgeIndex(nnet, arena);
+		UpdateEdgeIndex(nnet);
 		return nnet;
 	}
 
@@ -21,62 +29,559 @@ namespace jv::ai
 		arena.DestroyScope(nnet.scope);
 	}
 
+	NNetState CreateNNetState(const NNet& nnet, Arena& arena)
+	{
+		NNetState state{};
+		state.length = PadToKernelWidth(nnet.createInfo.neuronCapacity);
+		state.scope = arena.CreateScope();
+		state.values = NewAligned<float>(arena, state.length);
+		return state;
+	}
+
+	void DestroyNNetState(NNetState& state, Arena& arena)
+	{
+		arena.DestroyScope(state.scope);
+	}
+
 	void Clean(NNet& nnet)
 	{
-		for (uint32_t i = 0; i < nnet.neuronCount; i++)
-			nnet.neurons[i].value = 0;
+		Clean(nnet.state);
+	}
+
+	void Clean(NNetState& state)
+	{
+		for (uint32_t i = 0; i < state.length; i++)
+			state.values[i] = 0;
 	}
 
 	void Clear(NNet& nnet)
 	{
 		nnet.neuronCount = 0;
 		nnet.weightCount = 0;
+		nnet.coneValid = false;
+		UpdateEdgeIndex(nnet);
+	}
+
+	// "NNET" when read as bytes.
+	constexpr uint32_t NNET_FILE_MAGIC = 0x54454e4e;
+
+	static uint64_t AlignToFile(const uint64_t size)
+	{
+		return (size + NNET_FILE_ALIGNMENT - 1) / NNET_FILE_ALIGNMENT * NNET_FILE_ALIGNMENT;
+	}
+
+	static NNetFileHeader CreateFileHeader(const NNet& nnet)
+	{
+		NNetFileHeader header{};
+		header.magic = NNET_FILE_MAGIC;
+		header.version = NNET_FILE_VERSION;
+		header.createInfo = nnet.createInfo;
+		header.neuronCount = nnet.neuronCount;
+		header.weightCount = nnet.weightCount;
+		header.neuronSize = sizeof(Neuron);
+		header.weightSize = sizeof(Weight);
+		header.neuronMetaSize = sizeof(NeuronMeta);
+		header.weightMetaSize = sizeof(WeightMeta);
+		header.neuronOffset = AlignToFile(sizeof(NNetFileHeader));
+		header.weightOffset = AlignToFile(header.neuronOffset + sizeof(Neuron) * nnet.neuronCount);
+		header.neuronMetaOffset = AlignToFile(header.weightOffset + sizeof(Weight) * nnet.weightCount);
+		header.weightMetaOffset = AlignToFile(header.neuronMetaOffset + sizeof(NeuronMeta) * nnet.neuronCount);
+		header.size = AlignToFile(header.weightMetaOffset + sizeof(WeightMeta) * nnet.weightCount);
+		return header;
+	}
+
+	// Check if the record is compatible with this build and fits in the remaining bytes of the file.
+	static bool IsValid(const NNetFileHeader& header, const uint64_t remaining)
+	{
+		if (header.magic != NNET_FILE_MAGIC || header.version != NNET_FILE_VERSION)
+			return false;
+		if (header.neuronSize != sizeof(Neuron) || header.weightSize != sizeof(Weight))
+			return false;
+		if (header.neuronMetaSize != sizeof(NeuronMeta) || header.weightMetaSize != sizeof(WeightMeta))
+			return false;
+		if (header.size < sizeof(NNetFileHeader) || header.size > remaining || header.size % NNET_FILE_ALIGNMENT != 0)
+			return false;
+		if (header.neuronOffset % NNET_FILE_ALIGNMENT != 0 || header.weightOffset % NNET_FILE_ALIGNMENT != 0 ||
+			header.neuronMetaOffset % NNET_FILE_ALIGNMENT != 0 || header.weightMetaOffset % NNET_FILE_ALIGNMENT != 0)
+			return false;
+		return header.neuronOffset + sizeof(Neuron) * header.neuronCount <= header.size &&
+			header.weightOffset + sizeof(Weight) * header.weightCount <= header.size &&
+			header.neuronMetaOffset + sizeof(NeuronMeta) * header.neuronCount <= header.size &&
+			header.weightMetaOffset + sizeof(WeightMeta) * header.weightCount <= header.size;
+	}
+
+	// Amount of weight meta that is copied to the stack at a time when writing.
+	constexpr uint32_t WEIGHT_META_STAGING_SIZE = 256;
+
+	/*
+	WeightMeta has padding after enabled, which would otherwise be written as whatever happens to be in memory.
+	It's copied member by member into zeroed structs, so that identical networks give identical files.
+	The other arrays have no padding and are written as is.
+	*/
+	static void WriteWeightMeta(std::ostream& stream, const WeightMeta* weightMeta, const uint32_t count)
+	{
+		WeightMeta staging[WEIGHT_META_STAGING_SIZE];
+		memset(staging, 0, sizeof(staging));
+		for (uint32_t i = 0; i < count; i += WEIGHT_META_STAGING_SIZE)
+		{
+			const uint32_t batchSize = Min(count - i, WEIGHT_META_STAGING_SIZE);
+			for (uint32_t j = 0; j < batchSize; j++)
+			{
+				const auto& meta = weightMeta[i + j];
+				staging[j].innovationId = meta.innovationId;
+				staging[j].from = meta.from;
+				staging[j].enabled = meta.enabled;
+			}
+			stream.write(reinterpret_cast<const char*>(staging), sizeof(WeightMeta) * batchSize);
+		}
+	}
+
+	bool WriteNNet(std::ostream& stream, const NNet& nnet)
+	{
+		const auto header = CreateFileHeader(nnet);
+		const uint64_t neuronEnd = header.neuronOffset + sizeof(Neuron) * nnet.neuronCount;
+		const uint64_t weightEnd = header.weightOffset + sizeof(Weight) * nnet.weightCount;
+		const uint64_t neuronMetaEnd = header.neuronMetaOffset + sizeof(NeuronMeta) * nnet.neuronCount;
+		const uint64_t weightMetaEnd = header.weightMetaOffset + sizeof(WeightMeta) * nnet.weightCount;
+		const char padding[NNET_FILE_ALIGNMENT]{};
+
+		// Records are padded, so the next record in the file starts aligned as well.
+		stream.write(reinterpret_cast<const char*>(&header), sizeof(NNetFileHeader));
+		stream.write(padding, header.neuronOffset - sizeof(NNetFileHeader));
+		stream.write(reinterpret_cast<const char*>(nnet.neurons), sizeof(Neuron) * nnet.neuronCount);
+		stream.write(padding, header.weightOffset - neuronEnd);
+		stream.write(reinterpret_cast<const char*>(nnet.weights), sizeof(Weight) * nnet.weightCount);
+		stream.write(padding, header.neuronMetaOffset - weightEnd);
+		stream.write(reinterpret_cast<const char*>(nnet.neuronMeta), sizeof(NeuronMeta) * nnet.neuronCount);
+		stream.write(padding, header.weightMetaOffset - neuronMetaEnd);
+		WriteWeightMeta(stream, nnet.weightMeta, nnet.weightCount);
+		stream.write(padding, header.size - weightMetaEnd);
+		return stream.good();
+	}
+
+	NNet ReadNNet(std::istream& stream, Arena& arena)
+	{
+		const uint64_t start = stream.tellg();
+		stream.seekg(0, std::ios::end);
+		const uint64_t fileSize = stream.tellg();
+		stream.seekg(start);
+		if (!stream.good() || fileSize < start || fileSize - start < sizeof(NNetFileHeader))
+			return {};
+
+		NNetFileHeader header{};
+		stream.read(reinterpret_cast<char*>(&header), sizeof(NNetFileHeader));
+		if (!stream.good() || !IsValid(header, fileSize - start))
+			return {};
+
+		auto info = header.createInfo;
+		info.neuronCapacity = Max(info.neuronCapacity, header.neuronCount);
+		info.weightCapacity = Max(info.weightCapacity, header.weightCount);
+		auto nnet = CreateNNet(info, arena);
+
+		stream.seekg(start + header.neuronOffset);
+		stream.read(reinterpret_cast<char*>(nnet.neurons), sizeof(Neuron) * header.neuronCount);
+		stream.seekg(start + header.weightOffset);
+		stream.read(reinterpret_cast<char*>(nnet.weights), sizeof(Weight) * header.weightCount);
+		stream.seekg(start + header.neuronMetaOffset);
+		stream.read(reinterpret_cast<char*>(nnet.neuronMeta), sizeof(NeuronMeta) * header.neuronCount);
+		stream.seekg(start + header.weightMetaOffset);
+		stream.read(reinterpret_cast<char*>(nnet.weightMeta), sizeof(WeightMeta) * header.weightCount);
+		stream.seekg(start + header.size);
+		if (!stream.good())
+		{
+			DestroyNNet(nnet, arena);
+			return {};
+		}
+
+		nnet.neuronCount = header.neuronCount;
+		nnet.weightCount = header.weightCount;
+		UpdateEdgeIndex(nnet);
+		return nnet;
+	}
+
+	bool SaveNNet(const char* path, const NNet& nnet, const bool append)
+	{
+		std::ofstream fout(path, std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+		if (!fout.good())
+			return false;
+		return WriteNNet(fout, nnet);
+	}
+
+	NNet LoadNNet(const char* path, Arena& arena, const uint32_t index)
+	{
+		std::ifstream fin(path, std::ios::binary);
+		if (!fin.good())
+			return {};
+
+		fin.seekg(0, std::ios::end);
+		const uint64_t fileSize = fin.tellg();
+
+		// Skip to the requested record.
+		uint64_t start = 0;
+		for (uint32_t i = 0; i < index; i++)
+		{
+			NNetFileHeader header{};
+			fin.seekg(start);
+			if (fileSize - start < sizeof(NNetFileHeader))
+				return {};
+			fin.read(reinterpret_cast<char*>(&header), sizeof(NNetFileHeader));
+			if (!fin.good() || !IsValid(header, fileSize - start))
+				return {};
+			start += header.size;
+		}
+
+		fin.seekg(start);
+		return ReadNNet(fin, arena);
+	}
+
+	NNetArchive MapNNet(const char* path, Arena& arena)
+	{
+		NNetArchive archive{};
+
+		const HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return archive;
+		LARGE_INTEGER fileSize{};
+		const bool hasSize = GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0;
+		const HANDLE mapping = hasSize ? CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr) : nullptr;
+		CloseHandle(file);
+		if (!mapping)
+			return archive;
+		// The view keeps the file alive on its own.
+		void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		CloseHandle(mapping);
+		if (!view)
+			return archive;
+
+		// Validate all records before handing out any of them.
+		const auto bytes = static_cast<char*>(view);
+		const uint64_t size = fileSize.QuadPart;
+		uint32_t count = 0;
+		for (uint64_t offset = 0; offset < size; count++)
+		{
+			const auto header = reinterpret_cast<const NNetFileHeader*>(&bytes[offset]);
+			if (size - offset < sizeof(NNetFileHeader) || !IsValid(*header, size - offset))
+			{
+				UnmapViewOfFile(view);
+				return archive;
+			}
+			offset += header->size;
+		}
+
+		archive.scope = arena.CreateScope();
+		archive.view = view;
+		archive.count = count;
+		archive.nnets = arena.New<NNet>(count);
+
+		uint64_t offset = 0;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const auto& header = *reinterpret_cast<const NNetFileHeader*>(&bytes[offset]);
+			auto& nnet = archive.nnets[i];
+			// Like a created network, so that DestroyNNet only releases this one and the ones after it.
+			nnet.scope = arena.CreateScope();
+			nnet.createInfo = header.createInfo;
+			// The arrays in the file have no room to grow.
+			nnet.createInfo.neuronCapacity = header.neuronCount;
+			nnet.createInfo.weightCapacity = header.weightCount;
+			nnet.neurons = reinterpret_cast<Neuron*>(&bytes[offset + header.neuronOffset]);
+			nnet.weights = reinterpret_cast<Weight*>(&bytes[offset + header.weightOffset]);
+			nnet.neuronMeta = reinterpret_cast<NeuronMeta*>(&bytes[offset + header.neuronMetaOffset]);
+			nnet.weightMeta = reinterpret_cast<WeightMeta*>(&bytes[offset + header.weightMetaOffset]);
+			nnet.neuronCount = header.neuronCount;
+			nnet.weightCount = header.weightCount;
+			nnet.state = CreateNNetState(nnet, arena);
+			nnet.cone = arena.New<uint32_t>(header.neuronCount);
+			CreateEdgeIndex(nnet, arena);
+			UpdateEdgeIndex(nnet);
+			offset += header.size;
+		}
+		return archive;
+	}
+
+	void UnmapNNet(NNetArchive& archive, Arena& arena)
+	{
+		if (!archive.view)
+			return;
+		arena.DestroyScope(archive.scope);
+		UnmapViewOfFile(archive.view);
+		archive = {};
+	}
+
+	void UpdateCone(NNet& nnet)
+	{
+		// The cone array is used to store a live flag per neuron first.
+		uint32_t* live = nnet.cone;
+		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+			live[i] = false;
+		for (uint32_t i = 0; i < nnet.createInfo.outputSize; i++)
+			live[nnet.createInfo.inputSize + i] = true;
+
+		// Iterate until nothing changes. Most weights point forward, so going backwards usually settles in a few passes.
+		bool changed = true;
+		while (changed)
+		{
+			changed = false;
+			for (uint32_t i = nnet.neuronCount; i-- > 0;)
+			{
+				if (live[i])
+					continue;
+
+				uint32_t weightId = nnet.neurons[i].weightsId;
+				while (weightId != UINT32_MAX)
+				{
+					const auto& weight = nnet.weights[weightId];
+					if (live[weight.to])
+					{
+						live[i] = true;
+						changed = true;
+						break;
+					}
+					weightId = weight.next;
+				}
+			}
+		}
+
+		// Compact the flags into an ordered list of indices.
+		nnet.coneCount = 0;
+		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+			if (live[i])
+				nnet.cone[nnet.coneCount++] = i;
+		nnet.coneValid = true;
 	}
 
 	void Propagate(NNet& nnet, float* input, bool* output)
 	{
+		if (!nnet.coneValid)
+			UpdateCone(nnet);
+		Propagate(nnet, nnet.state, input, output);
+	}
+
+	// Output is optional, so that steps whose output is not needed can skip the readout.
+	static void Step(const NNet& nnet, float* values, const float* input, bool* output)
+	{
+		const uint32_t count = nnet.coneValid ? nnet.coneCount : nnet.neuronCount;
+		const uint32_t* cone = nnet.coneValid ? nnet.cone : nullptr;
+
 		for (uint32_t i = 0; i < nnet.createInfo.inputSize; i++)
-			nnet.neurons[i].value = input[i];
+			values[i] = input[i];
 
-		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+		for (uint32_t j = 0; j < count; j++)
 		{
-			auto& neuron = nnet.neurons[i];
+			const uint32_t i = cone ? cone[j] : j;
+			const auto& neuron = nnet.neurons[i];
 			uint32_t weightId = neuron.weightsId;
-			neuron.value = Max<float>(neuron.value, 0);
+			values[i] = Max<float>(values[i], 0);
 
-			if (neuron.value > neuron.threshold)
+			if (values[i] > neuron.threshold)
 			{
-				while (weightId != -1)
+				while (weightId != UINT32_MAX)
 				{
-					auto& weight = nnet.weights[weightId];
-					auto& nextNeuron = nnet.neurons[weight.to];
-					float value = weight.value * weight.enabled;
-					nextNeuron.value += value;
+					const auto& weight = nnet.weights[weightId];
+					values[weight.to] += weight.value;
 					weightId = weight.next;
 				}
 			}
 		}
 
 		// Ready output.
-		for (uint32_t i = 0; i < nnet.createInfo.outputSize; i++)
+		if (output)
+			for (uint32_t i = 0; i < nnet.createInfo.outputSize; i++)
+			{
+				const uint32_t id = nnet.createInfo.inputSize + i;
+				output[i] = values[id] > nnet.neurons[id].threshold;
+			}
+
+		// Clamp values, reset spiked neurons and apply decay.
+		for (uint32_t j = 0; j < count; j++)
+		{
+			const uint32_t i = cone ? cone[j] : j;
+			const auto& neuron = nnet.neurons[i];
+			values[i] = values[i] > neuron.threshold ? 0 : values[i];
+			values[i] *= neuron.decay;
+		}
+	}
+
+	void Propagate(const NNet& nnet, NNetState& state, const float* input, bool* output)
+	{
+		assert(nnet.neuronCount <= state.length);
+		Step(nnet, state.values, input, output);
+	}
+
+	void PropagateSequence(const NNet& nnet, NNetState& state, const float* inputs, bool* outputs,
+		const uint32_t length, const uint32_t outputLength)
+	{
+		assert(nnet.neuronCount <= state.length);
+		const uint32_t inputSize = nnet.createInfo.inputSize;
+		const uint32_t outputSize = nnet.createInfo.outputSize;
+		const uint32_t firstOutput = length - Min(length, outputLength);
+
+		for (uint32_t i = 0; i < length; i++)
+		{
+			bool* output = i < firstOutput ? nullptr : &outputs[(i - firstOutput) * outputSize];
+			Step(nnet, state.values, &inputs[i * inputSize], output);
+		}
+	}
+
+	NNetBatch CreateNNetBatch(const NNet& nnet, const uint32_t batchSize, Arena& arena)
+	{
+		NNetBatch batch{};
+		batch.batchSize = batchSize;
+		batch.neuronCapacity = nnet.createInfo.neuronCapacity;
+		batch.scope = arena.CreateScope();
+		batch.values = arena.New<float>(batch.neuronCapacity * batchSize);
+		batch.spikes = arena.New<float>(batchSize);
+		return batch;
+	}
+
+	void DestroyNNetBatch(NNetBatch& batch, Arena& arena)
+	{
+		arena.DestroyScope(batch.scope);
+	}
+
+	void Clean(NNetBatch& batch)
+	{
+		const uint32_t length = batch.neuronCapacity * batch.batchSize;
+		for (uint32_t i = 0; i < length; i++)
+			batch.values[i] = 0;
+	}
+
+	void PropagateBatch(NNet& nnet, NNetBatch& batch, float* inputs, bool* outputs)
+	{
+		assert(nnet.neuronCount <= batch.neuronCapacity);
+		if (!nnet.coneValid)
+			UpdateCone(nnet);
+
+		const uint32_t batchSize = batch.batchSize;
+		const uint32_t inputSize = nnet.createInfo.inputSize;
+		const uint32_t outputSize = nnet.createInfo.outputSize;
+		float* spikes = batch.spikes;
+
+		for (uint32_t i = 0; i < inputSize; i++)
+		{
+			float* lanes = &batch.values[i * batchSize];
+			for (uint32_t j = 0; j < batchSize; j++)
+				lanes[j] = inputs[j * inputSize + i];
+		}
+
+		for (uint32_t k = 0; k < nnet.coneCount; k++)
 		{
-			const auto& neuron = nnet.neurons[nnet.createInfo.inputSize + i];
-			output[i] = neuron.value > neuron.threshold;
+			const uint32_t i = nnet.cone[k];
+			const auto& neuron = nnet.neurons[i];
+			float* lanes = &batch.values[i * batchSize];
+
+			bool spiked = false;
+			for (uint32_t j = 0; j < batchSize; j++)
+			{
+				const float value = Max<float>(lanes[j], 0);
+				lanes[j] = value;
+				spikes[j] = value > neuron.threshold;
+				spiked = spiked || value > neuron.threshold;
+			}
+
+			if (!spiked)
+				continue;
+
+			// Walk the weights once for all lanes.
+			uint32_t weightId = neuron.weightsId;
+			while (weightId != UINT32_MAX)
+			{
+				const auto& weight = nnet.weights[weightId];
+				weightId = weight.next;
+
+				float* nextLanes = &batch.values[weight.to * batchSize];
+				const float value = weight.value;
+				for (uint32_t j = 0; j < batchSize; j++)
+					nextLanes[j] += value * spikes[j];
+			}
+		}
+
+		// Ready output.
+		for (uint32_t i = 0; i < outputSize; i++)
+		{
+			const uint32_t id = inputSize + i;
+			const float threshold = nnet.neurons[id].threshold;
+			const float* lanes = &batch.values[id * batchSize];
+			for (uint32_t j = 0; j < batchSize; j++)
+				outputs[j * outputSize + i] = lanes[j] > threshold;
 		}
 
 		// Clamp values, reset spiked neurons and apply decay.
-		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+		for (uint32_t k = 0; k < nnet.coneCount; k++)
+		{
+			const uint32_t i = nnet.cone[k];
+			const auto& neuron = nnet.neurons[i];
+			float* lanes = &batch.values[i * batchSize];
+			for (uint32_t j = 0; j < batchSize; j++)
+			{
+				const float value = lanes[j] > neuron.threshold ? 0 : lanes[j];
+				lanes[j] = value * neuron.decay;
+			}
+		}
+	}
+
+	[[nodiscard]] static uint64_t GetEdgeKey(const uint32_t from, const uint32_t to)
+	{
+		return static_cast<uint64_t>(from) << 32 | to;
+	}
+
+	// First slot to look at for a key. Fibonacci hashing spreads neighbouring neurons over the whole table.
+	[[nodiscard]] static uint32_t GetEdgeSlot(const NNet& nnet, const uint64_t key)
+	{
+		return static_cast<uint32_t>(key * 0x9e3779b97f4a7c15 >> 32) & nnet.edgeMask;
+	}
+
+	bool AddEdge(NNet& nnet, const uint32_t from, const uint32_t to)
+	{
+		const uint64_t key = GetEdgeKey(from, to);
+		uint32_t slot = GetEdgeSlot(nnet, key);
+		while (nnet.edges[slot] != UINT64_MAX)
 		{
-			auto& neuron = nnet.neurons[i];
-			neuron.value = neuron.value > neuron.threshold ? 0 : neuron.value;
-			neuron.value *= neuron.decay;
+			if (nnet.edges[slot] == key)
+				return false;
+			slot = (slot + 1) & nnet.edgeMask;
 		}
+		nnet.edges[slot] = key;
+		return true;
+	}
+
+	bool HasWeight(const NNet& nnet, const uint32_t from, const uint32_t to)
+	{
+		const uint64_t key = GetEdgeKey(from, to);
+		uint32_t slot = GetEdgeSlot(nnet, key);
+		while (nnet.edges[slot] != UINT64_MAX)
+		{
+			if (nnet.edges[slot] == key)
+				return true;
+			slot = (slot + 1) & nnet.edgeMask;
+		}
+		return false;
+	}
+
+	void CreateEdgeIndex(NNet& nnet, Arena& arena)
+	{
+		// Keep the table at most half full, so that probes stay short.
+		uint32_t size = 16;
+		while (size < nnet.createInfo.weightCapacity * 2)
+			size *= 2;
+		nnet.edges = arena.New<uint64_t>(size);
+		nnet.edgeMask = size - 1;
+	}
+
+	void UpdateEdgeIndex(NNet& nnet)
+	{
+		memset(nnet.edges, 0xff, sizeof(uint64_t) * (nnet.edgeMask + 1));
+		for (uint32_t i = 0; i < nnet.weightCount; i++)
+			AddEdge(nnet, nnet.weightMeta[i].from, nnet.weights[i].to);
 	}
 
 	bool AddWeight(NNet& nnet, const uint32_t from, const uint32_t to, const float value, uint32_t& gId)
 	{
 		if (nnet.weightCount >= nnet.createInfo.weightCapacity)
 			return false;
+		assert(!nnet.sharesNeurons && !nnet.sharesWeights);
+		if (!AddEdge(nnet, from, to))
+			return false;
 		assert(from < nnet.neuronCount);
 		assert(to < nnet.neuronCount);
 
@@ -84,12 +589,14 @@ namespace jv::ai
 		assert(to >= nnet.createInfo.inputSize);
 		Neuron& neuron = nnet.neurons[from];
 		Weight& weight = nnet.weights[nnet.weightCount] = {};
-		weight.innovationId = gId++;
-		weight.from = from;
+		WeightMeta& meta = nnet.weightMeta[nnet.weightCount] = {};
+		meta.innovationId = gId++;
+		meta.from = from;
 		weight.to = to;
 		weight.value = value;
 		weight.next = neuron.weightsId;
 		neuron.weightsId = nnet.weightCount++;
+		nnet.coneValid = false;
 		return true;
 	}
 
@@ -97,12 +604,14 @@ namespace jv::ai
 	{
 		if (nnet.neuronCount >= nnet.createInfo.neuronCapacity)
 			return false;
+		assert(!nnet.sharesNeurons);
 
+		nnet.state.values[nnet.neuronCount] = 0;
+		nnet.neuronMeta[nnet.neuronCount] = { gId++ };
 		Neuron& neuron = nnet.neurons[nnet.neuronCount++] = {};
-		neuron.value = 0;
 		neuron.decay = decay;
 		neuron.threshold = threshold;
-		neuron.innovationId = gId++;
+		nnet.coneValid = false;
 		return true;
 	}
 }
\ No newline at end of file
@@ -1,23 +1,35 @@
 #pragma once
 #include "JLib/Arena.h"
+#include <iosfwd>
 
 namespace jv::ai
 {
+	// Only the data needed to propagate. Bookkeeping is stored in NeuronMeta.
 	struct Neuron final
 	{
-		float value;
 		float decay;
 		float threshold;
-		uint32_t innovationId;
 		uint32_t weightsId = UINT32_MAX;
 	};
 
+	struct NeuronMeta final
+	{
+		uint32_t innovationId;
+	};
+
+	// Only the data needed to propagate. Bookkeeping is stored in WeightMeta.
 	struct Weight final
 	{
 		float value;
-		uint32_t from, to;
-		uint32_t innovationId;
+		uint32_t to;
 		uint32_t next = UINT32_MAX;
+	};
+
+	struct WeightMeta final
+	{
+		uint32_t innovationId;
+		uint32_t from;
+		// Disabled weights are never part of a chain, so propagating doesn't have to check this.
 		bool enabled = true;
 	};
 
@@ -29,26 +41,157 @@ namespace jv::ai
 		uint32_t outputSize;
 	};
 
+	// Current value of all neurons. Kept apart from the network so that one network can be evaluated by many callers.
+	struct NNetState final
+	{
+		uint64_t scope;
+		// Padded to the kernel width, see NNetKernels.h.
+		uint32_t length;
+		float* values;
+	};
+
 	struct NNet final
 	{
 		NNetCreateInfo createInfo;
 		uint64_t scope;
 		Neuron* neurons;
 		Weight* weights;
+		// Used for crossover and compatibility, kept apart to keep the arrays above dense.
+		NeuronMeta* neuronMeta;
+		WeightMeta* weightMeta;
+		uint32_t neuronCount;
+		uint32_t weightCount;
+		// Default state, used when propagating without an explicit state.
+		NNetState state;
+		// Neurons that lie on a path to an output neuron, in order. Only these have to be propagated.
+		uint32_t* cone;
+		uint32_t coneCount;
+		// Reset by any change to the topology.
+		bool coneValid;
+		// Set if the arrays belong to another network, see Share. The edge index is part of the weights.
+		bool sharesNeurons;
+		bool sharesWeights;
+		// Hash set of all (from, to) pairs that have a weight, including disabled ones. Empty slots are UINT64_MAX.
+		uint64_t* edges;
+		uint32_t edgeMask;
+	};
+
+	// Current version of the binary format. Changes whenever the layout of a Neuron or Weight changes.
+	constexpr uint32_t NNET_FILE_VERSION = 2;
+	// Alignment of all records and arrays in a file, so that a mapped file can be used in place.
+	constexpr uint32_t NNET_FILE_ALIGNMENT = 64;
+
+	/*
+	Start of a network record in a file. A file can hold multiple records back to back, like a hall of fame archive.
+	The neuron and weight arrays are stored as is, so files are only portable between builds with the same layout.
+	*/
+	struct NNetFileHeader final
+	{
+		uint32_t magic;
+		uint32_t version;
+		// Size of the record including the header and padding.
+		uint64_t size;
+		NNetCreateInfo createInfo;
 		uint32_t neuronCount;
 		uint32_t weightCount;
+		uint32_t neuronSize;
+		uint32_t weightSize;
+		uint32_t neuronMetaSize;
+		uint32_t weightMetaSize;
+		// Offsets relative to the start of the record.
+		uint64_t neuronOffset;
+		uint64_t weightOffset;
+		uint64_t neuronMetaOffset;
+		uint64_t weightMetaOffset;
+	};
+
+	// All networks in a memory mapped file.
+	struct NNetArchive final
+	{
+		uint64_t scope;
+		void* view;
+		NNet* nnets;
+		uint32_t count;
+	};
+
+	// Neuron values for multiple independent samples of the same network, stored as [neuron][lane].
+	struct NNetBatch final
+	{
+		uint64_t scope;
+		uint32_t batchSize;
+		uint32_t neuronCapacity;
+		float* values;
+		// Per lane spike mask of the neuron that is currently being propagated.
+		float* spikes;
 	};
 
 	__declspec(dllexport) [[nodiscard]] NNet CreateNNet(NNetCreateInfo& info, Arena& arena);
 	__declspec(dllexport) void DestroyNNet(NNet& nnet, Arena& arena);
 
+	// Create a state that can hold the values of all neurons the network can have.
+	__declspec(dllexport) [[nodiscard]] NNetState CreateNNetState(const NNet& nnet, Arena& arena);
+	__declspec(dllexport) void DestroyNNetState(NNetState& state, Arena& arena);
+
 	// Reset the current value of all neurons to 0.
 	__declspec(dllexport) void Clean(NNet& nnet);
+	__declspec(dllexport) void Clean(NNetState& state);
 	// Destroy all neurons and weights.
 	__declspec(dllexport) void Clear(NNet& nnet);
-	// Forward information through the network.
+
+	// Write the network to a file, or add it to the end of an existing one. Returns false if the file can't be written.
+	__declspec(dllexport) bool SaveNNet(const char* path, const NNet& nnet, bool append = false);
+	// Read a network from a file into the arena. Returns a network without neurons if the record can't be read.
+	__declspec(dllexport) [[nodiscard]] NNet LoadNNet(const char* path, Arena& arena, uint32_t index = 0);
+	// Write a network record at the current position of a stream, so that networks can be part of other files.
+	__declspec(dllexport) bool WriteNNet(std::ostream& stream, const NNet& nnet);
+	// Read the network record at the current position of a stream and move past it. See LoadNNet.
+	__declspec(dllexport) [[nodiscard]] NNet ReadNNet(std::istream& stream, Arena& arena);
+	/*
+	Map a file into memory and use the networks inside in place, without copying them.
+	Pages are copy on write, so networks can be mutated without changing the file, but they can't grow.
+	Only the states and cones are allocated from the arena. Returns an empty archive if the file is invalid.
+	Every network has a scope of its own, but the file stays mapped until the archive is released with UnmapNNet.
+	*/
+	__declspec(dllexport) [[nodiscard]] NNetArchive MapNNet(const char* path, Arena& arena);
+	__declspec(dllexport) void UnmapNNet(NNetArchive& archive, Arena& arena);
+	/*
+	Find all neurons that can reach an output neuron. Neurons outside of this cone are skipped when propagating,
+	which means their values are no longer updated.
+	*/
+	__declspec(dllexport) void UpdateCone(NNet& nnet);
+	// Forward information through the network, using its default state. Updates the cone if needed.
 	__declspec(dllexport) void Propagate(NNet& nnet, float* input, bool* output);
+	/*
+	Forward information through the network. The network itself is not changed, so it can be shared between threads.
+	Only uses the cone if it is valid, call UpdateCone beforehand to make use of it.
+	*/
+	__declspec(dllexport) void Propagate(const NNet& nnet, NNetState& state, const float* input, bool* output);
+	/*
+	Forward a sequence of inputs through the network in one call. Inputs are laid out as [length][inputSize].
+	Only the outputs of the last outputLength steps are written as [outputLength][outputSize], so a warmup can be skipped.
+	*/
+	__declspec(dllexport) void PropagateSequence(const NNet& nnet, NNetState& state, const float* inputs, bool* outputs,
+		uint32_t length, uint32_t outputLength = UINT32_MAX);
+
+	__declspec(dllexport) [[nodiscard]] NNetBatch CreateNNetBatch(const NNet& nnet, uint32_t batchSize, Arena& arena);
+	__declspec(dllexport) void DestroyNNetBatch(NNetBatch& batch, Arena& arena);
+	// Reset the current value of all neurons in all lanes to 0.
+	__declspec(dllexport) void Clean(NNetBatch& batch);
+	/*
+	Forward batchSize independent samples through the network in one pass over the weights. Updates the cone if needed.
+	Inputs are laid out as [batchSize][inputSize], outputs as [batchSize][outputSize].
+	*/
+	__declspec(dllexport) void PropagateBatch(NNet& nnet, NNetBatch& batch, float* inputs, bool* outputs);
 
+	// Fails if the network is full or if the neurons are already connected.
 	__declspec(dllexport) bool AddWeight(NNet& nnet, uint32_t from, uint32_t to, float value, uint32_t& gId);
+	// Check if there is a weight between the two neurons, enabled or not.
+	__declspec(dllexport) [[nodiscard]] bool HasWeight(const NNet& nnet, uint32_t from, uint32_t to);
+	// Allocate an edge index that fits the weight capacity of the network, without filling it.
+	__declspec(dllexport) void CreateEdgeIndex(NNet& nnet, Arena& arena);
+	// Add a pair of neurons to the edge index. Returns false if they were already connected.
+	__declspec(dllexport) bool AddEdge(NNet& nnet, uint32_t from, uint32_t to);
+	// Fill the edge index again, needed after writing to the weights without AddWeight.
+	__declspec(dllexport) void UpdateEdgeIndex(NNet& nnet);
 	__declspec(dllexport) bool AddNeuron(NNet& nnet, float decay, float threshold, uint32_t& gId);
 }
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include "pch.h"
+#include "NNetJit.h"
+
+namespace jv::ai
+{
+#if defined(_M_X64)
+	// Registers as used by the Windows x64 calling convention.
+	enum Register : uint8_t
+	{
+		rax = 0,
+		rcx = 1,
+		rdx = 2,
+		// Extended registers, need REX.B when used as base.
+		r8 = 8,
+		r9 = 9
+	};
+
+	// Bare bones x86-64 encoder. Memory operands are always [base + disp32].
+	struct Emitter final
+	{
+		uint8_t* ptr;
+
+		void Byte(const uint8_t byte)
+		{
+			*ptr++ = byte;
+		}
+
+		void Int32(const int32_t value)
+		{
+			memcpy(ptr, &value, sizeof(int32_t));
+			ptr += sizeof(int32_t);
+		}
+
+		// Optional mandatory prefix, REX, opcode, mod = 10 ModRM and displacement.
+		void Memory(const uint8_t prefix, const uint8_t opcode, const bool twoByte,
+			const uint8_t reg, const Register base, const int32_t disp)
+		{
+			if (prefix)
+				Byte(prefix);
+			if (base & 8)
+				Byte(0x41);
+			if (twoByte)
+				Byte(0x0f);
+			Byte(opcode);
+			Byte(0x80 | (reg & 7) << 3 | (base & 7));
+			Int32(disp);
+		}
+
+		void RegReg(const uint8_t prefix, const uint8_t opcode, const uint8_t reg, const uint8_t rm)
+		{
+			if (prefix)
+				Byte(prefix);
+			Byte(0x0f);
+			Byte(opcode);
+			Byte(0xc0 | (reg & 7) << 3 | (rm & 7));
+		}
+
+		void MovssLoad(const uint8_t xmm, const Register base, const int32_t disp)
+		{
+			Memory(0xf3, 0x10, true, xmm, base, disp);
+		}
+
+		void MovssStore(const Register base, const int32_t disp, const uint8_t xmm)
+		{
+			Memory(0xf3, 0x11, true, xmm, base, disp);
+		}
+	};
+
+	// Size of the largest instruction sequences per element, used to reserve the code buffer.
+	constexpr size_t JIT_INPUT_SIZE = 12;
+	constexpr size_t JIT_NEURON_SIZE = 34 + 42;
+	constexpr size_t JIT_EDGE_SIZE = 25;
+	constexpr size_t JIT_OUTPUT_SIZE = 26;
+	constexpr size_t JIT_MISC_SIZE = 16;
+
+	static void Emit(Emitter& e, const NNetPlan& plan)
+	{
+		const uint32_t n = plan.neuronCount;
+		const auto threshold = [](const uint32_t i) { return static_cast<int32_t>(i * sizeof(float)); };
+		const auto decay = [n](const uint32_t i) { return static_cast<int32_t>((n + i) * sizeof(float)); };
+		const auto weight = [n](const uint32_t i) { return static_cast<int32_t>((n * 2 + i) * sizeof(float)); };
+		const auto value = [](const uint32_t i) { return static_cast<int32_t>(i * sizeof(float)); };
+
+		// xmm2 = 0.
+		e.RegReg(0, 0x57, 2, 2);
+
+		// Copy the input.
+		for (uint32_t i = 0; i < plan.inputSize; i++)
+		{
+			e.Memory(0, 0x8b, false, rax, rdx, value(i));
+			e.Memory(0, 0x89, false, rax, rcx, value(i));
+		}
+
+		for (uint32_t i = 0; i < n; i++)
+		{
+			// values[i] = max(values[i], 0).
+			e.MovssLoad(0, rcx, value(i));
+			e.RegReg(0xf3, 0x5f, 0, 2);
+			e.MovssStore(rcx, value(i), 0);
+
+			const uint32_t start = plan.offsets[i];
+			const uint32_t end = plan.offsets[i + 1];
+			if (start == end)
+				continue;
+
+			// Skip the edges if values[i] <= threshold (or unordered).
+			e.Memory(0, 0x2e, true, 0, r9, threshold(i));
+			e.Byte(0x0f);
+			e.Byte(0x86);
+			uint8_t* jump = e.ptr;
+			e.Int32(0);
+
+			for (uint32_t j = start; j < end; j++)
+			{
+				const uint32_t target = plan.targets[j];
+				e.MovssLoad(1, rcx, value(target));
+				e.Memory(0xf3, 0x58, true, 1, r9, weight(j));
+				e.MovssStore(rcx, value(target), 1);
+			}
+
+			const int32_t offset = static_cast<int32_t>(e.ptr - (jump + sizeof(int32_t)));
+			memcpy(jump, &offset, sizeof(int32_t));
+		}
+
+		// Ready output: output[i] = values[id] > threshold.
+		for (uint32_t i = 0; i < plan.outputSize; i++)
+		{
+			const uint32_t id = plan.inputSize + i;
+			e.MovssLoad(0, rcx, value(id));
+			e.Memory(0, 0x2e, true, 0, r9, threshold(id));
+			e.Byte(0x0f);
+			e.Byte(0x97);
+			e.Byte(0xc0);
+			e.Memory(0, 0x88, false, rax, r8, static_cast<int32_t>(i));
+		}
+
+		// Reset spiked neurons and apply decay, without branches.
+		for (uint32_t i = 0; i < n; i++)
+		{
+			e.MovssLoad(0, rcx, value(i));
+			e.MovssLoad(1, r9, threshold(i));
+			// xmm1 = !(threshold < value) ? all ones : 0.
+			e.RegReg(0xf3, 0xc2, 1, 0);
+			e.Byte(5);
+			e.RegReg(0, 0x54, 0, 1);
+			e.Memory(0xf3, 0x59, true, 0, r9, decay(i));
+			e.MovssStore(rcx, value(i), 0);
+		}
+
+		// ret.
+		e.Byte(0xc3);
+	}
+#endif
+
+	JitNNet CompileJit(const NNetPlan& plan, Arena& arena)
+	{
+		JitNNet nnet{};
+		nnet.plan = plan;
+		nnet.scope = arena.CreateScope();
+
+		const uint32_t n = plan.neuronCount;
+		nnet.constants = arena.New<float>(n * 2 + plan.edgeCount);
+		memcpy(nnet.constants, plan.thresholds, sizeof(float) * n);
+		memcpy(&nnet.constants[n], plan.decays, sizeof(float) * n);
+		memcpy(&nnet.constants[n * 2], plan.values, sizeof(float) * plan.edgeCount);
+
+#if defined(_M_X64)
+		const size_t maxSize = JIT_MISC_SIZE + plan.inputSize * JIT_INPUT_SIZE + n * JIT_NEURON_SIZE +
+			plan.edgeCount * JIT_EDGE_SIZE + plan.outputSize * JIT_OUTPUT_SIZE;
+		void* code = VirtualAlloc(nullptr, maxSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!code)
+			return nnet;
+
+		Emitter emitter{};
+		emitter.ptr = static_cast<uint8_t*>(code);
+		Emit(emitter, plan);
+		nnet.codeSize = emitter.ptr - static_cast<uint8_t*>(code);
+		assert(nnet.codeSize <= maxSize);
+
+		DWORD oldProtect;
+		if (!VirtualProtect(code, maxSize, PAGE_EXECUTE_READ, &oldProtect))
+		{
+			VirtualFree(code, 0, MEM_RELEASE);
+			return nnet;
+		}
+		FlushInstructionCache(GetCurrentProcess(), code, nnet.codeSize);
+
+		nnet.code = code;
+		nnet.function = reinterpret_cast<JitFunction>(code);
+#endif
+		return nnet;
+	}
+
+	void DestroyJit(JitNNet& nnet, Arena& arena)
+	{
+#if defined(_M_X64)
+		if (nnet.code)
+			VirtualFree(nnet.code, 0, MEM_RELEASE);
+#endif
+		nnet.code = nullptr;
+		nnet.function = nullptr;
+		arena.DestroyScope(nnet.scope);
+	}
+
+	void Propagate(const JitNNet& nnet, NNetState& state, const float* input, bool* output)
+	{
+		if (!nnet.function)
+		{
+			Propagate(nnet.plan, state, input, output);
+			return;
+		}
+
+		assert(nnet.plan.neuronCount <= state.length);
+		nnet.function(state.values, input, output, nnet.constants);
+	}
+}
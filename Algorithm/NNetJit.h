@@ -0,0 +1,30 @@
+#pragma once
+#include "NNetPlan.h"
+
+namespace jv::ai
+{
+	// Machine code generated for one specific plan. The constants hold the thresholds, decays and weights.
+	typedef void (*JitFunction)(float* values, const float* input, bool* output, const float* constants);
+
+	/*
+	Execution plan compiled to straight-line x86-64 code, with all indices baked into the instructions.
+	Falls back to interpreting the plan on unsupported platforms. The plan has to outlive the jitted network.
+	*/
+	struct JitNNet final
+	{
+		uint64_t scope;
+		NNetPlan plan;
+		// Null if no code could be generated.
+		JitFunction function;
+		void* code;
+		size_t codeSize;
+		float* constants;
+	};
+
+	__declspec(dllexport) [[nodiscard]] JitNNet CompileJit(const NNetPlan& plan, Arena& arena);
+	// Also releases the executable memory.
+	__declspec(dllexport) void DestroyJit(JitNNet& nnet, Arena& arena);
+
+	// Forward information through the jitted network. Gives the same result as propagating the plan.
+	__declspec(dllexport) void Propagate(const JitNNet& nnet, NNetState& state, const float* input, bool* output);
+}
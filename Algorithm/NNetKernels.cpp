@@ -0,0 +1,198 @@
+#include "pch.h"
+#include "NNetKernels.h"
+#include <intrin.h>
+#include <immintrin.h>
+#include <cmath>
+
+namespace jv::ai
+{
+	static void ReadyOutputScalar(const float* values, const float* thresholds, bool* output, const uint32_t length)
+	{
+		for (uint32_t i = 0; i < length; i++)
+			output[i] = values[i] > thresholds[i];
+	}
+
+	static void ResetAndDecayScalar(float* values, const float* thresholds, const float* decays, const uint32_t length)
+	{
+		for (uint32_t i = 0; i < length; i++)
+		{
+			const float value = values[i] > thresholds[i] ? 0 : values[i];
+			values[i] = value * decays[i];
+		}
+	}
+
+	static void ReadyOutputSSE(const float* values, const float* thresholds, bool* output, const uint32_t length)
+	{
+		uint32_t i = 0;
+		for (; i + 4 <= length; i += 4)
+		{
+			const __m128 mask = _mm_cmpgt_ps(_mm_loadu_ps(&values[i]), _mm_loadu_ps(&thresholds[i]));
+			const int bits = _mm_movemask_ps(mask);
+			for (uint32_t j = 0; j < 4; j++)
+				output[i + j] = bits >> j & 1;
+		}
+		ReadyOutputScalar(&values[i], &thresholds[i], &output[i], length - i);
+	}
+
+	static void ResetAndDecaySSE(float* values, const float* thresholds, const float* decays, const uint32_t length)
+	{
+		uint32_t i = 0;
+		for (; i + 4 <= length; i += 4)
+		{
+			const __m128 value = _mm_loadu_ps(&values[i]);
+			const __m128 spiked = _mm_cmpgt_ps(value, _mm_loadu_ps(&thresholds[i]));
+			const __m128 reset = _mm_andnot_ps(spiked, value);
+			_mm_storeu_ps(&values[i], _mm_mul_ps(reset, _mm_loadu_ps(&decays[i])));
+		}
+		ResetAndDecayScalar(&values[i], &thresholds[i], &decays[i], length - i);
+	}
+
+	static void ReadyOutputAVX(const float* values, const float* thresholds, bool* output, const uint32_t length)
+	{
+		uint32_t i = 0;
+		for (; i + 8 <= length; i += 8)
+		{
+			const __m256 mask = _mm256_cmp_ps(_mm256_loadu_ps(&values[i]), _mm256_loadu_ps(&thresholds[i]), _CMP_GT_OQ);
+			const int bits = _mm256_movemask_ps(mask);
+			for (uint32_t j = 0; j < 8; j++)
+				output[i + j] = bits >> j & 1;
+		}
+		ReadyOutputSSE(&values[i], &thresholds[i], &output[i], length - i);
+	}
+
+	static void ResetAndDecayAVX(float* values, const float* thresholds, const float* decays, const uint32_t length)
+	{
+		uint32_t i = 0;
+		for (; i + 8 <= length; i += 8)
+		{
+			const __m256 value = _mm256_loadu_ps(&values[i]);
+			const __m256 spiked = _mm256_cmp_ps(value, _mm256_loadu_ps(&thresholds[i]), _CMP_GT_OQ);
+			const __m256 reset = _mm256_andnot_ps(spiked, value);
+			_mm256_storeu_ps(&values[i], _mm256_mul_ps(reset, _mm256_loadu_ps(&decays[i])));
+		}
+		ResetAndDecaySSE(&values[i], &thresholds[i], &decays[i], length - i);
+	}
+
+	static uint32_t IntersectScalar(const uint32_t* aIds, const float* aValues, const uint32_t aCount,
+		const uint32_t* bIds, const float* bValues, const uint32_t bCount, float& difference)
+	{
+		uint32_t count = 0;
+		uint32_t i = 0;
+		uint32_t j = 0;
+		while (i < aCount && j < bCount)
+		{
+			const uint32_t aId = aIds[i];
+			const uint32_t bId = bIds[j];
+			if (aId == bId)
+			{
+				difference += fabsf(aValues[i] - bValues[j]);
+				++count;
+			}
+			i += aId <= bId;
+			j += bId <= aId;
+		}
+		return count;
+	}
+
+	/*
+	Compares blocks of 4 ids against all 4 rotations of the other block, then moves past the block with the lowest maximum.
+	Every pair of blocks that can share an id is compared exactly once, since the ids are unique and sorted.
+	*/
+	static uint32_t IntersectSSE(const uint32_t* aIds, const float* aValues, const uint32_t aCount,
+		const uint32_t* bIds, const float* bValues, const uint32_t bCount, float& difference)
+	{
+		// Amount of set bits in a 4 bit mask.
+		constexpr uint32_t bitCounts[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+		uint32_t count = 0;
+		__m128 differences = _mm_setzero_ps();
+		uint32_t i = 0;
+		uint32_t j = 0;
+
+		while (i + 4 <= aCount && j + 4 <= bCount)
+		{
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&aIds[i]));
+			const __m128 aValue = _mm_loadu_ps(&aValues[i]);
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&bIds[j]));
+			__m128 bValue = _mm_loadu_ps(&bValues[j]);
+
+			for (uint32_t r = 0; r < 4; r++)
+			{
+				const __m128 equal = _mm_castsi128_ps(_mm_cmpeq_epi32(a, b));
+				count += bitCounts[_mm_movemask_ps(equal)];
+				const __m128 difference = _mm_and_ps(absMask, _mm_sub_ps(aValue, bValue));
+				differences = _mm_add_ps(differences, _mm_and_ps(equal, difference));
+				b = _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 3, 2, 1));
+				bValue = _mm_shuffle_ps(bValue, bValue, _MM_SHUFFLE(0, 3, 2, 1));
+			}
+
+			const uint32_t aMax = aIds[i + 3];
+			const uint32_t bMax = bIds[j + 3];
+			i += aMax <= bMax ? 4 : 0;
+			j += bMax <= aMax ? 4 : 0;
+		}
+
+		float lanes[4];
+		_mm_storeu_ps(lanes, differences);
+		difference += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		return count + IntersectScalar(&aIds[i], &aValues[i], aCount - i, &bIds[j], &bValues[j], bCount - j, difference);
+	}
+
+	static bool IsAVXSupported()
+	{
+		int info[4];
+		__cpuid(info, 1);
+		const bool osxsave = info[2] & 1 << 27;
+		const bool avx = info[2] & 1 << 28;
+		if (!osxsave || !avx)
+			return false;
+		// Make sure the OS saves the upper halves of the ymm registers.
+		return (_xgetbv(0) & 6) == 6;
+	}
+
+	static bool IsSSESupported()
+	{
+#if defined(_M_X64) || defined(__x86_64__)
+		return true;
+#else
+		int info[4];
+		__cpuid(info, 1);
+		return info[3] & 1 << 26;
+#endif
+	}
+
+	const NeuronKernels& GetNeuronKernels()
+	{
+		static const NeuronKernels kernels = GetNeuronKernels(
+			IsAVXSupported() ? KernelType::avx : IsSSESupported() ? KernelType::sse : KernelType::scalar);
+		return kernels;
+	}
+
+	NeuronKernels GetNeuronKernels(const KernelType type)
+	{
+		NeuronKernels kernels{};
+		kernels.type = type;
+
+		switch (type)
+		{
+		case KernelType::avx:
+			kernels.readyOutput = ReadyOutputAVX;
+			kernels.resetAndDecay = ResetAndDecayAVX;
+			// AVX has no integer compares at full width.
+			kernels.intersect = IntersectSSE;
+			break;
+		case KernelType::sse:
+			kernels.readyOutput = ReadyOutputSSE;
+			kernels.resetAndDecay = ResetAndDecaySSE;
+			kernels.intersect = IntersectSSE;
+			break;
+		default:
+			kernels.readyOutput = ReadyOutputScalar;
+			kernels.resetAndDecay = ResetAndDecayScalar;
+			kernels.intersect = IntersectScalar;
+			break;
+		}
+		return kernels;
+	}
+}
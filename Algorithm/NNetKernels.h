@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include "JLib/Arena.h"
+
+namespace jv::ai
+{
+	// Arrays used by the kernels are aligned to and padded up to this many bytes.
+	constexpr uint32_t KERNEL_ALIGNMENT = 32;
+	// Amount of floats processed per instruction by the widest kernel.
+	constexpr uint32_t KERNEL_WIDTH = 8;
+
+	enum class KernelType
+	{
+		scalar,
+		sse,
+		avx
+	};
+
+	// Spiking neuron update kernels that work on separate value, threshold and decay arrays.
+	struct NeuronKernels final
+	{
+		KernelType type;
+		// output[i] = values[i] > thresholds[i].
+		void (*readyOutput)(const float* values, const float* thresholds, bool* output, uint32_t length);
+		// values[i] = (values[i] > thresholds[i] ? 0 : values[i]) * decays[i].
+		void (*resetAndDecay)(float* values, const float* thresholds, const float* decays, uint32_t length);
+		/*
+		Count the ids that two sorted arrays of unique ids have in common, used to compare genomes.
+		The absolute differences between the values of the matching ids are summed into difference.
+		*/
+		uint32_t (*intersect)(const uint32_t* aIds, const float* aValues, uint32_t aCount,
+			const uint32_t* bIds, const float* bValues, uint32_t bCount, float& difference);
+	};
+
+	// Allocate a zeroed array that is aligned for the kernels.
+	template <typename T>
+	[[nodiscard]] T* NewAligned(Arena& arena, const uint32_t count)
+	{
+		const uint32_t size = sizeof(T) * count;
+		auto ptr = static_cast<char*>(arena.Alloc(size + KERNEL_ALIGNMENT - 1));
+		ptr += (KERNEL_ALIGNMENT - reinterpret_cast<uintptr_t>(ptr) % KERNEL_ALIGNMENT) % KERNEL_ALIGNMENT;
+		memset(ptr, 0, size);
+		return reinterpret_cast<T*>(ptr);
+	}
+
+	// Round a neuron count up to the kernel width.
+	[[nodiscard]] constexpr uint32_t PadToKernelWidth(const uint32_t count)
+	{
+		return (count + KERNEL_WIDTH - 1) / KERNEL_WIDTH * KERNEL_WIDTH;
+	}
+
+	// Get the widest kernels supported by this CPU. Detected once on first use.
+	__declspec(dllexport) [[nodiscard]] const NeuronKernels& GetNeuronKernels();
+	// Get the kernels for a specific instruction set, for instance to test them against the scalar fallback.
+	__declspec(dllexport) [[nodiscard]] NeuronKernels GetNeuronKernels(KernelType type);
+}
@@ -0,0 +1,469 @@
+#include "pch.h"
+#include "NNetPlan.h"
+#include "NNetKernels.h"
+#include "Jlib/Math.h"
+
+namespace jv::ai
+{
+	/*
+	Write the edges of a neuron to [start, start + count). Edges to a contiguous range of distinct neurons are ordered by
+	target, so that the neuron can become a row of a block. Other edges keep the order of the chain.
+	Targets within a chain are unique, so the order doesn't change the result.
+	*/
+	static void FillEdges(NNetPlan& plan, const NNet& nnet, const uint32_t neuronId, const uint32_t start, const uint32_t count)
+	{
+		uint32_t minTarget = UINT32_MAX;
+		uint32_t maxTarget = 0;
+		uint32_t weightId = nnet.neurons[neuronId].weightsId;
+		while (weightId != UINT32_MAX)
+		{
+			const auto& weight = nnet.weights[weightId];
+			minTarget = Min(minTarget, weight.to);
+			maxTarget = Max(maxTarget, weight.to);
+			weightId = weight.next;
+		}
+
+		// Mark the slots to catch duplicate targets, which older files can still contain.
+		bool dense = count > 0 && maxTarget - minTarget + 1 == count;
+		if (dense)
+		{
+			for (uint32_t i = start; i < start + count; i++)
+				plan.edgeWeights[i] = UINT32_MAX;
+			weightId = nnet.neurons[neuronId].weightsId;
+			while (weightId != UINT32_MAX)
+			{
+				uint32_t& mark = plan.edgeWeights[start + nnet.weights[weightId].to - minTarget];
+				dense = dense && mark == UINT32_MAX;
+				mark = weightId;
+				weightId = nnet.weights[weightId].next;
+			}
+		}
+
+		uint32_t edgeId = start;
+		weightId = nnet.neurons[neuronId].weightsId;
+		while (weightId != UINT32_MAX)
+		{
+			const auto& weight = nnet.weights[weightId];
+			const uint32_t id = dense ? start + weight.to - minTarget : edgeId++;
+			plan.targets[id] = weight.to;
+			plan.values[id] = weight.value;
+			plan.edgeWeights[id] = weightId;
+			plan.weightEdges[weightId] = id;
+			weightId = weight.next;
+		}
+	}
+
+	// Find the runs of neurons whose edges form a dense matrix.
+	static void UpdateBlocks(NNetPlan& plan)
+	{
+		plan.blockCount = 0;
+		for (uint32_t i = 0; i < plan.neuronCount; i++)
+		{
+			const uint32_t start = plan.offsets[i];
+			const uint32_t count = plan.offsets[i + 1] - start;
+			if (count == 0)
+				continue;
+
+			const uint32_t firstTarget = plan.targets[start];
+			bool dense = true;
+			for (uint32_t j = 1; j < count; j++)
+				dense = dense && plan.targets[start + j] == firstTarget + j;
+			if (!dense)
+				continue;
+
+			// Extend the previous block if this neuron directly follows it and none of the rows become targets.
+			NNetBlock* block = plan.blockCount > 0 ? &plan.blocks[plan.blockCount - 1] : nullptr;
+			const bool extends = block && block->firstNeuron + block->neuronCount == i &&
+				block->firstTarget == firstTarget && block->targetCount == count;
+			const uint32_t firstRow = extends ? block->firstNeuron : i;
+			if (firstTarget < i + 1 && firstTarget + count > firstRow)
+				continue;
+
+			if (extends)
+				++block->neuronCount;
+			else
+				plan.blocks[plan.blockCount++] = { i, 1, firstTarget, count };
+		}
+	}
+
+	NNetPlan CompileNNet(const NNet& nnet, Arena& arena)
+	{
+		NNetPlan plan{};
+		plan.inputSize = nnet.createInfo.inputSize;
+		plan.outputSize = nnet.createInfo.outputSize;
+		plan.neuronCount = nnet.neuronCount;
+		plan.paddedNeuronCount = PadToKernelWidth(nnet.neuronCount);
+		plan.neuronCapacity = Max(nnet.createInfo.neuronCapacity, nnet.neuronCount);
+		plan.weightCapacity = Max(nnet.createInfo.weightCapacity, nnet.weightCount);
+
+		// Count the weights that are actually reached when propagating.
+		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+		{
+			uint32_t weightId = nnet.neurons[i].weightsId;
+			while (weightId != UINT32_MAX)
+			{
+				++plan.edgeCount;
+				weightId = nnet.weights[weightId].next;
+			}
+		}
+
+		plan.scope = arena.CreateScope();
+		const uint32_t paddedCapacity = PadToKernelWidth(plan.neuronCapacity);
+		plan.thresholds = NewAligned<float>(arena, paddedCapacity);
+		plan.decays = NewAligned<float>(arena, paddedCapacity);
+		plan.offsets = arena.New<uint32_t>(plan.neuronCapacity + 1);
+		// Every weight can become an edge.
+		plan.targets = arena.New<uint32_t>(plan.weightCapacity);
+		plan.values = arena.New<float>(plan.weightCapacity);
+		plan.edgeWeights = arena.New<uint32_t>(plan.weightCapacity);
+		plan.weightEdges = arena.New<uint32_t>(plan.weightCapacity);
+		plan.blocks = arena.New<NNetBlock>(plan.neuronCapacity);
+		for (uint32_t i = 0; i < nnet.weightCount; i++)
+			plan.weightEdges[i] = UINT32_MAX;
+
+		uint32_t edgeId = 0;
+		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+		{
+			const auto& neuron = nnet.neurons[i];
+			plan.thresholds[i] = neuron.threshold;
+			plan.decays[i] = neuron.decay;
+			plan.offsets[i] = edgeId;
+
+			uint32_t count = 0;
+			uint32_t weightId = neuron.weightsId;
+			while (weightId != UINT32_MAX)
+			{
+				++count;
+				weightId = nnet.weights[weightId].next;
+			}
+			FillEdges(plan, nnet, i, edgeId, count);
+			edgeId += count;
+		}
+		plan.offsets[plan.neuronCount] = edgeId;
+		UpdateBlocks(plan);
+		return plan;
+	}
+
+	void DestroyNNetPlan(NNetPlan& plan, Arena& arena)
+	{
+		arena.DestroyScope(plan.scope);
+	}
+
+	// Replace the edges of a neuron with the weights in its current chain.
+	static void RebuildEdges(NNetPlan& plan, const NNet& nnet, const uint32_t neuronId)
+	{
+		uint32_t count = 0;
+		uint32_t weightId = nnet.neurons[neuronId].weightsId;
+		while (weightId != UINT32_MAX)
+		{
+			++count;
+			weightId = nnet.weights[weightId].next;
+		}
+
+		const uint32_t start = plan.offsets[neuronId];
+		const uint32_t end = plan.offsets[neuronId + 1];
+		const int32_t diff = static_cast<int32_t>(count) - static_cast<int32_t>(end - start);
+		assert(plan.edgeCount + diff <= plan.weightCapacity);
+
+		for (uint32_t i = start; i < end; i++)
+			plan.weightEdges[plan.edgeWeights[i]] = UINT32_MAX;
+
+		// Move the edges of all following neurons.
+		if (diff != 0)
+		{
+			const uint32_t tail = plan.edgeCount - end;
+			memmove(&plan.targets[end + diff], &plan.targets[end], sizeof(uint32_t) * tail);
+			memmove(&plan.values[end + diff], &plan.values[end], sizeof(float) * tail);
+			memmove(&plan.edgeWeights[end + diff], &plan.edgeWeights[end], sizeof(uint32_t) * tail);
+			plan.edgeCount += diff;
+			for (uint32_t i = start + count; i < plan.edgeCount; i++)
+				plan.weightEdges[plan.edgeWeights[i]] = i;
+			for (uint32_t i = neuronId + 1; i <= plan.neuronCount; i++)
+				plan.offsets[i] += diff;
+		}
+
+		FillEdges(plan, nnet, neuronId, start, count);
+	}
+
+	bool ApplyDelta(NNetPlan& plan, const NNet& nnet, const MutationDelta& delta)
+	{
+		if (nnet.neuronCount > plan.neuronCapacity || nnet.weightCount > plan.weightCapacity)
+			return false;
+
+		for (uint32_t i = 0; i < delta.weightCount; i++)
+		{
+			const uint32_t weightId = delta.weights[i];
+			const uint32_t edgeId = plan.weightEdges[weightId];
+			if (edgeId != UINT32_MAX)
+				plan.values[edgeId] = nnet.weights[weightId].value;
+		}
+
+		for (uint32_t i = 0; i < delta.neuronCount; i++)
+		{
+			const uint32_t neuronId = delta.neurons[i];
+			plan.thresholds[neuronId] = nnet.neurons[neuronId].threshold;
+			plan.decays[neuronId] = nnet.neurons[neuronId].decay;
+		}
+
+		// New neurons start without edges, their weights are added below.
+		for (uint32_t i = plan.neuronCount; i < nnet.neuronCount; i++)
+		{
+			plan.thresholds[i] = nnet.neurons[i].threshold;
+			plan.decays[i] = nnet.neurons[i].decay;
+			plan.offsets[i + 1] = plan.edgeCount;
+		}
+		plan.neuronCount = nnet.neuronCount;
+		plan.paddedNeuronCount = PadToKernelWidth(nnet.neuronCount);
+
+		for (uint32_t i = delta.firstNewWeight; i < nnet.weightCount; i++)
+			plan.weightEdges[i] = UINT32_MAX;
+
+		// Splitting a weight also cuts off the rest of the chain it was in.
+		if (delta.splitWeight != UINT32_MAX)
+			RebuildEdges(plan, nnet, nnet.weightMeta[delta.splitWeight].from);
+		for (uint32_t i = delta.firstNewWeight; i < nnet.weightCount; i++)
+			RebuildEdges(plan, nnet, nnet.weightMeta[i].from);
+		if (delta.splitWeight != UINT32_MAX || delta.firstNewNeuron < nnet.neuronCount || delta.firstNewWeight < nnet.weightCount)
+			UpdateBlocks(plan);
+		return true;
+	}
+
+	NNetState CreateNNetState(const NNetPlan& plan, Arena& arena)
+	{
+		NNetState state{};
+		// Leave room for neurons added by patching the plan.
+		state.length = PadToKernelWidth(plan.neuronCapacity);
+		state.scope = arena.CreateScope();
+		state.values = NewAligned<float>(arena, state.length);
+		return state;
+	}
+
+	// Add a strip of up to KERNEL_WIDTH targets for all spiking rows, keeping the sums in registers.
+	static void AccumulateStrip(const float* matrix, const uint32_t stride, const uint32_t rowCount, const uint64_t spikes,
+		float* targets, const uint32_t width)
+	{
+		float sums[KERNEL_WIDTH];
+		for (uint32_t k = 0; k < width; k++)
+			sums[k] = targets[k];
+		for (uint32_t j = 0; j < rowCount; j++)
+		{
+			if (!(spikes >> j & 1))
+				continue;
+			const float* row = &matrix[j * stride];
+			for (uint32_t k = 0; k < width; k++)
+				sums[k] += row[k];
+		}
+		for (uint32_t k = 0; k < width; k++)
+			targets[k] = sums[k];
+	}
+
+	/*
+	Propagate a block as a matrix vector product with the spikes of its rows.
+	Rows are added in the same order as edge by edge propagation would, so the result is identical.
+	*/
+	static void PropagateBlock(const NNetPlan& plan, const NNetBlock& block, float* activations)
+	{
+		float* targets = &activations[block.firstTarget];
+		const uint32_t stride = block.targetCount;
+		const uint32_t fullWidth = stride / KERNEL_WIDTH * KERNEL_WIDTH;
+
+		// Rows are handled 64 at a time, so that their spikes fit in a mask.
+		for (uint32_t r = 0; r < block.neuronCount; r += 64)
+		{
+			const uint32_t rowCount = Min<uint32_t>(64, block.neuronCount - r);
+			const uint32_t firstRow = block.firstNeuron + r;
+
+			uint64_t spikes = 0;
+			for (uint32_t j = 0; j < rowCount; j++)
+			{
+				const float value = Max<float>(activations[firstRow + j], 0);
+				activations[firstRow + j] = value;
+				spikes |= static_cast<uint64_t>(value > plan.thresholds[firstRow + j]) << j;
+			}
+			if (!spikes)
+				continue;
+
+			const float* matrix = &plan.values[plan.offsets[firstRow]];
+			for (uint32_t c = 0; c < fullWidth; c += KERNEL_WIDTH)
+				AccumulateStrip(&matrix[c], stride, rowCount, spikes, &targets[c], KERNEL_WIDTH);
+			if (fullWidth < stride)
+				AccumulateStrip(&matrix[fullWidth], stride, rowCount, spikes, &targets[fullWidth], stride - fullWidth);
+		}
+	}
+
+	// Output is optional, so that steps whose output is not needed can skip the readout.
+	static void Step(const NNetPlan& plan, const NeuronKernels& kernels, float* activations, const float* input, bool* output)
+	{
+		for (uint32_t i = 0; i < plan.inputSize; i++)
+			activations[i] = input[i];
+
+		uint32_t blockId = 0;
+		for (uint32_t i = 0; i < plan.neuronCount; i++)
+		{
+			if (blockId < plan.blockCount && plan.blocks[blockId].firstNeuron == i)
+			{
+				const auto& block = plan.blocks[blockId++];
+				PropagateBlock(plan, block, activations);
+				i += block.neuronCount - 1;
+				continue;
+			}
+
+			const float value = Max<float>(activations[i], 0);
+			activations[i] = value;
+
+			if (value > plan.thresholds[i])
+			{
+				const uint32_t end = plan.offsets[i + 1];
+				for (uint32_t j = plan.offsets[i]; j < end; j++)
+					activations[plan.targets[j]] += plan.values[j];
+			}
+		}
+
+		// Ready output.
+		if (output)
+			kernels.readyOutput(&activations[plan.inputSize], &plan.thresholds[plan.inputSize], output, plan.outputSize);
+		// Clamp values, reset spiked neurons and apply decay.
+		kernels.resetAndDecay(activations, plan.thresholds, plan.decays, plan.paddedNeuronCount);
+	}
+
+	void Propagate(const NNetPlan& plan, NNetState& state, const float* input, bool* output)
+	{
+		assert(plan.paddedNeuronCount <= state.length);
+		Step(plan, GetNeuronKernels(), state.values, input, output);
+	}
+
+	void PropagateSequence(const NNetPlan& plan, NNetState& state, const float* inputs, bool* outputs,
+		const uint32_t length, const uint32_t outputLength)
+	{
+		assert(plan.paddedNeuronCount <= state.length);
+		const auto& kernels = GetNeuronKernels();
+		const uint32_t firstOutput = length - Min(length, outputLength);
+
+		for (uint32_t i = 0; i < length; i++)
+		{
+			bool* output = i < firstOutput ? nullptr : &outputs[(i - firstOutput) * plan.outputSize];
+			Step(plan, kernels, state.values, &inputs[i * plan.inputSize], output);
+		}
+	}
+
+	NNetEvents CreateNNetEvents(const NNetPlan& plan, Arena& arena)
+	{
+		NNetEvents events{};
+		// Leave room for neurons added by patching the plan.
+		events.wordCount = (plan.neuronCapacity + 63) / 64;
+		events.scope = arena.CreateScope();
+		events.touched = arena.New<uint64_t>(events.wordCount);
+		events.stamps = arena.New<uint32_t>(plan.neuronCapacity);
+		return events;
+	}
+
+	void DestroyNNetEvents(NNetEvents& events, Arena& arena)
+	{
+		arena.DestroyScope(events.scope);
+	}
+
+	// Bring the activation of an idle neuron up to date with the current step.
+	static float CatchUp(const NNetPlan& plan, const NNetEvents& events, const float* activations, const uint32_t id)
+	{
+		const uint32_t idleSteps = events.step - events.stamps[id];
+		const float value = activations[id];
+		if (idleSteps == 0)
+			return value;
+		// Idle neurons are clamped and then decayed every step.
+		return Max<float>(value, 0) * powf(plan.decays[id], static_cast<float>(idleSteps));
+	}
+
+	void Flush(const NNetPlan& plan, NNetEvents& events, NNetState& state)
+	{
+		for (uint32_t i = 0; i < plan.neuronCount; i++)
+		{
+			state.values[i] = CatchUp(plan, events, state.values, i);
+			events.stamps[i] = events.step;
+		}
+	}
+
+	void PropagateEvents(const NNetPlan& plan, NNetEvents& events, NNetState& state, const float* input, bool* output)
+	{
+		assert(plan.neuronCount <= state.length);
+		float* activations = state.values;
+		uint64_t* touched = events.touched;
+		const uint32_t step = events.step;
+
+		for (uint32_t i = 0; i < plan.inputSize; i++)
+		{
+			activations[i] = input[i];
+			events.stamps[i] = step;
+			touched[i / 64] |= 1ull << i % 64;
+		}
+
+		// Visit touched neurons in order. Neurons touched by an earlier neuron are picked up in the same step.
+		for (uint32_t w = 0; w < events.wordCount; w++)
+		{
+			uint32_t bit = 0;
+			uint64_t remaining = touched[w];
+
+			while (remaining)
+			{
+				while (!(remaining >> bit & 1))
+					++bit;
+				const uint32_t i = w * 64 + bit;
+
+				const float value = Max<float>(activations[i], 0);
+				activations[i] = value;
+
+				if (value > plan.thresholds[i])
+				{
+					const uint32_t end = plan.offsets[i + 1];
+					for (uint32_t j = plan.offsets[i]; j < end; j++)
+					{
+						const uint32_t target = plan.targets[j];
+						uint64_t& word = touched[target / 64];
+						const uint64_t mask = 1ull << target % 64;
+
+						if (!(word & mask))
+						{
+							float targetValue = CatchUp(plan, events, activations, target);
+							// Neurons that have already been passed were clamped during this step.
+							targetValue = target < i ? Max<float>(targetValue, 0) : targetValue;
+							activations[target] = targetValue;
+							events.stamps[target] = step;
+							word |= mask;
+						}
+						activations[target] += plan.values[j];
+					}
+				}
+
+				++bit;
+				remaining = bit < 64 ? touched[w] >> bit << bit : 0;
+			}
+		}
+
+		// Ready output. Idle neurons are below their threshold.
+		for (uint32_t i = 0; i < plan.outputSize; i++)
+		{
+			const uint32_t id = plan.inputSize + i;
+			const bool isTouched = touched[id / 64] >> id % 64 & 1;
+			output[i] = isTouched && activations[id] > plan.thresholds[id];
+		}
+
+		// Reset spiked neurons and apply decay, but only for the neurons that were touched.
+		for (uint32_t w = 0; w < events.wordCount; w++)
+		{
+			uint64_t remaining = touched[w];
+			for (uint32_t bit = 0; remaining; bit++)
+			{
+				if (!(remaining >> bit & 1))
+					continue;
+				remaining &= ~(1ull << bit);
+
+				const uint32_t i = w * 64 + bit;
+				const float value = activations[i] > plan.thresholds[i] ? 0 : activations[i];
+				activations[i] = value * plan.decays[i];
+				events.stamps[i] = step + 1;
+			}
+			touched[w] = 0;
+		}
+
+		++events.step;
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include "NNet.h"
+#include "NNetUtils.h"
+
+namespace jv::ai
+{
+	/*
+	Consecutive neurons whose edges all go to the same contiguous range of neurons, like the ones made by Connect.
+	The edges of the rows are stored back to back as a row major matrix, ordered by target.
+	None of the targets are rows of the block, so all rows can decide whether they spike before any of them fire.
+	*/
+	struct NNetBlock final
+	{
+		uint32_t firstNeuron;
+		uint32_t neuronCount;
+		uint32_t firstTarget;
+		uint32_t targetCount;
+	};
+
+	/*
+	Read-only execution plan of a neural network.
+	Neurons keep their order, but their outgoing weights are stored as contiguous (CSR) arrays.
+	Disabled weights are dropped.
+	Per neuron arrays are aligned and padded for the SIMD kernels in NNetKernels.h.
+	Arrays are sized to the capacity of the network, so that the plan can be patched after mutating it.
+	*/
+	struct NNetPlan final
+	{
+		uint64_t scope;
+		uint32_t inputSize;
+		uint32_t outputSize;
+		uint32_t neuronCount;
+		// Neuron count rounded up to the kernel width. Padded neurons never spike.
+		uint32_t paddedNeuronCount;
+		uint32_t edgeCount;
+		uint32_t neuronCapacity;
+		uint32_t weightCapacity;
+		float* thresholds;
+		float* decays;
+		// Outgoing edges of neuron i are in range [offsets[i], offsets[i + 1]).
+		uint32_t* offsets;
+		uint32_t* targets;
+		float* values;
+		// Weight that each edge originates from.
+		uint32_t* edgeWeights;
+		// Edge of each weight, UINT32_MAX if the weight is not part of the plan.
+		uint32_t* weightEdges;
+		// Ordered by first neuron. Propagated as a matrix vector product instead of edge by edge.
+		NNetBlock* blocks;
+		uint32_t blockCount;
+	};
+
+	/*
+	Bookkeeping for event driven propagation of a plan.
+	Only neurons that received input in a step are visited. Idle neurons are decayed lazily when they are touched again,
+	which is valid as long as thresholds are positive and decays are within [0, 1], like Mutate guarantees.
+	*/
+	struct NNetEvents final
+	{
+		uint64_t scope;
+		uint32_t step;
+		uint32_t wordCount;
+		// Bitset of neurons that received input in the current step.
+		uint64_t* touched;
+		// Step at which the activation of a neuron was last brought up to date.
+		uint32_t* stamps;
+	};
+
+	// Compile the network into an execution plan.
+	__declspec(dllexport) [[nodiscard]] NNetPlan CompileNNet(const NNet& nnet, Arena& arena);
+	__declspec(dllexport) void DestroyNNetPlan(NNetPlan& plan, Arena& arena);
+	/*
+	Patch the plan after the network it was compiled from has been mutated. Value changes are applied in place.
+	Structural changes only rebuild the edges of the affected neurons, but move the edges after them.
+	Returns false if the network outgrew the capacity of the plan, in which case it has to be compiled again.
+	*/
+	__declspec(dllexport) bool ApplyDelta(NNetPlan& plan, const NNet& nnet, const MutationDelta& delta);
+	// Create a state that fits the plan. A state created from the original network can be used as well.
+	__declspec(dllexport) [[nodiscard]] NNetState CreateNNetState(const NNetPlan& plan, Arena& arena);
+
+	// Forward information through the plan. Gives the same result as propagating the original network.
+	__declspec(dllexport) void Propagate(const NNetPlan& plan, NNetState& state, const float* input, bool* output);
+	// Forward a sequence of inputs through the plan in one call. See the PropagateSequence of NNet.
+	__declspec(dllexport) void PropagateSequence(const NNetPlan& plan, NNetState& state, const float* inputs, bool* outputs,
+		uint32_t length, uint32_t outputLength = UINT32_MAX);
+
+	__declspec(dllexport) [[nodiscard]] NNetEvents CreateNNetEvents(const NNetPlan& plan, Arena& arena);
+	__declspec(dllexport) void DestroyNNetEvents(NNetEvents& events, Arena& arena);
+	// Apply all pending decay, so that the state is up to date.
+	__declspec(dllexport) void Flush(const NNetPlan& plan, NNetEvents& events, NNetState& state);
+	// Forward information through the plan, only visiting neurons that received input. Work scales with the amount of spikes.
+	__declspec(dllexport) void PropagateEvents(const NNetPlan& plan, NNetEvents& events, NNetState& state,
+		const float* input, bool* output);
+}
@@ -0,0 +1,273 @@
+#include "pch.h"
+#include "NNetQuantized.h"
+#include "Jlib/Math.h"
+
+namespace jv::ai
+{
+	uint16_t FloatToHalf(const float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(float));
+
+		const uint16_t sign = bits >> 16 & 0x8000;
+		const int32_t exponent = static_cast<int32_t>(bits >> 23 & 0xff);
+		uint32_t mantissa = bits & 0x7fffff;
+
+		// Infinity and NaN.
+		if (exponent == 0xff)
+			return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+		const int32_t halfExponent = exponent - 127 + 15;
+		if (halfExponent >= 31)
+			return sign | 0x7c00;
+
+		// Subnormal or too small to represent.
+		if (halfExponent <= 0)
+		{
+			if (halfExponent < -10)
+				return sign;
+			mantissa |= 0x800000;
+			const uint32_t shift = 14 - halfExponent;
+			uint32_t half = mantissa >> shift;
+			const uint32_t remainder = mantissa & ((1u << shift) - 1);
+			const uint32_t halfway = 1u << (shift - 1);
+			half += remainder > halfway || (remainder == halfway && half & 1);
+			return sign | static_cast<uint16_t>(half);
+		}
+
+		// A carry out of the mantissa correctly bumps the exponent.
+		uint32_t half = halfExponent << 10 | mantissa >> 13;
+		const uint32_t remainder = mantissa & 0x1fff;
+		half += remainder > 0x1000 || (remainder == 0x1000 && half & 1);
+		return sign | static_cast<uint16_t>(half);
+	}
+
+	float HalfToFloat(const uint16_t value)
+	{
+		const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+		int32_t exponent = value >> 10 & 0x1f;
+		uint32_t mantissa = value & 0x3ff;
+		uint32_t bits;
+
+		if (exponent == 0x1f)
+			bits = sign | 0x7f800000 | mantissa << 13;
+		else if (exponent != 0)
+			bits = sign | (exponent - 15 + 127) << 23 | mantissa << 13;
+		else if (mantissa == 0)
+			bits = sign;
+		else
+		{
+			// Normalize the subnormal.
+			exponent = -14;
+			while (!(mantissa & 0x400))
+			{
+				mantissa <<= 1;
+				--exponent;
+			}
+			mantissa &= 0x3ff;
+			bits = sign | (exponent + 127) << 23 | mantissa << 13;
+		}
+
+		float ret;
+		memcpy(&ret, &bits, sizeof(float));
+		return ret;
+	}
+
+	// Scale that maps the largest absolute value onto the given range.
+	[[nodiscard]] static float GetScale(const float* values, const uint32_t length, const float range)
+	{
+		float max = 0;
+		for (uint32_t i = 0; i < length; i++)
+			max = Max<float>(max, fabsf(values[i]));
+		return max > 0 ? max / range : 1;
+	}
+
+	[[nodiscard]] static uint8_t ToUnsigned(const float value, const float scale)
+	{
+		return static_cast<uint8_t>(Clamp<float>(roundf(value / scale), 0, 255));
+	}
+
+	[[nodiscard]] static int8_t ToSigned(const float value, const float scale)
+	{
+		return static_cast<int8_t>(Clamp<float>(roundf(value / scale), -127, 127));
+	}
+
+	QuantizedNNet Quantize(const NNetPlan& plan, const Precision precision, Arena& arena)
+	{
+		QuantizedNNet nnet{};
+		nnet.precision = precision;
+		nnet.inputSize = plan.inputSize;
+		nnet.outputSize = plan.outputSize;
+		nnet.neuronCount = plan.neuronCount;
+		nnet.edgeCount = plan.edgeCount;
+		nnet.thresholdScale = 1;
+		nnet.decayScale = 1;
+		nnet.weightScale = 1;
+
+		nnet.scope = arena.CreateScope();
+		nnet.offsets = arena.New<uint32_t>(plan.neuronCount + 1);
+		nnet.targets = arena.New<uint32_t>(plan.edgeCount);
+		memcpy(nnet.offsets, plan.offsets, sizeof(uint32_t) * (plan.neuronCount + 1));
+		memcpy(nnet.targets, plan.targets, sizeof(uint32_t) * plan.edgeCount);
+
+		switch (precision)
+		{
+		case Precision::fp16:
+		{
+			const auto thresholds = arena.New<uint16_t>(plan.neuronCount);
+			const auto decays = arena.New<uint16_t>(plan.neuronCount);
+			const auto values = arena.New<uint16_t>(plan.edgeCount);
+			for (uint32_t i = 0; i < plan.neuronCount; i++)
+			{
+				thresholds[i] = FloatToHalf(plan.thresholds[i]);
+				decays[i] = FloatToHalf(plan.decays[i]);
+			}
+			for (uint32_t i = 0; i < plan.edgeCount; i++)
+				values[i] = FloatToHalf(plan.values[i]);
+			nnet.thresholds = thresholds;
+			nnet.decays = decays;
+			nnet.values = values;
+			break;
+		}
+		case Precision::int8:
+		{
+			nnet.thresholdScale = GetScale(plan.thresholds, plan.neuronCount, 255);
+			nnet.decayScale = GetScale(plan.decays, plan.neuronCount, 255);
+			nnet.weightScale = GetScale(plan.values, plan.edgeCount, 127);
+
+			const auto thresholds = arena.New<uint8_t>(plan.neuronCount);
+			const auto decays = arena.New<uint8_t>(plan.neuronCount);
+			const auto values = arena.New<int8_t>(plan.edgeCount);
+			for (uint32_t i = 0; i < plan.neuronCount; i++)
+			{
+				thresholds[i] = ToUnsigned(plan.thresholds[i], nnet.thresholdScale);
+				decays[i] = ToUnsigned(plan.decays[i], nnet.decayScale);
+			}
+			for (uint32_t i = 0; i < plan.edgeCount; i++)
+				values[i] = ToSigned(plan.values[i], nnet.weightScale);
+			nnet.thresholds = thresholds;
+			nnet.decays = decays;
+			nnet.values = values;
+			break;
+		}
+		default:
+			break;
+		}
+
+		return nnet;
+	}
+
+	void DestroyQuantizedNNet(QuantizedNNet& nnet, Arena& arena)
+	{
+		arena.DestroyScope(nnet.scope);
+	}
+
+	[[nodiscard]] static float Decode(const uint16_t value, float)
+	{
+		return HalfToFloat(value);
+	}
+
+	[[nodiscard]] static float Decode(const uint8_t value, const float scale)
+	{
+		return static_cast<float>(value) * scale;
+	}
+
+	[[nodiscard]] static float Decode(const int8_t value, const float scale)
+	{
+		return static_cast<float>(value) * scale;
+	}
+
+	// N is the storage type of the thresholds and decays, W the storage type of the weights.
+	template <typename N, typename W>
+	static void PropagateQuantized(const QuantizedNNet& nnet, NNetState& state, const float* input, bool* output)
+	{
+		assert(nnet.neuronCount <= state.length);
+		const auto thresholds = static_cast<const N*>(nnet.thresholds);
+		const auto decays = static_cast<const N*>(nnet.decays);
+		const auto values = static_cast<const W*>(nnet.values);
+		float* activations = state.values;
+
+		for (uint32_t i = 0; i < nnet.inputSize; i++)
+			activations[i] = input[i];
+
+		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+		{
+			const float value = Max<float>(activations[i], 0);
+			activations[i] = value;
+
+			if (value > Decode(thresholds[i], nnet.thresholdScale))
+			{
+				const uint32_t end = nnet.offsets[i + 1];
+				for (uint32_t j = nnet.offsets[i]; j < end; j++)
+					activations[nnet.targets[j]] += Decode(values[j], nnet.weightScale);
+			}
+		}
+
+		// Ready output.
+		for (uint32_t i = 0; i < nnet.outputSize; i++)
+		{
+			const uint32_t id = nnet.inputSize + i;
+			output[i] = activations[id] > Decode(thresholds[id], nnet.thresholdScale);
+		}
+
+		// Clamp values, reset spiked neurons and apply decay.
+		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+		{
+			const float value = activations[i] > Decode(thresholds[i], nnet.thresholdScale) ? 0 : activations[i];
+			activations[i] = value * Decode(decays[i], nnet.decayScale);
+		}
+	}
+
+	void Propagate(const QuantizedNNet& nnet, NNetState& state, const float* input, bool* output)
+	{
+		switch (nnet.precision)
+		{
+		case Precision::fp16:
+			PropagateQuantized<uint16_t, uint16_t>(nnet, state, input, output);
+			break;
+		case Precision::int8:
+			PropagateQuantized<uint8_t, int8_t>(nnet, state, input, output);
+			break;
+		default:
+			break;
+		}
+	}
+
+	QuantizationDrift GetQuantizationDrift(const NNet& nnet, const QuantizedNNet& quantized,
+		const float* inputs, const uint32_t length, Arena& tempArena)
+	{
+		assert(nnet.createInfo.inputSize == quantized.inputSize);
+		assert(nnet.createInfo.outputSize == quantized.outputSize);
+
+		const auto tempScope = tempArena.CreateScope();
+		auto state = CreateNNetState(nnet, tempArena);
+		auto quantizedState = CreateNNetState(nnet, tempArena);
+		const uint32_t outputSize = nnet.createInfo.outputSize;
+		bool* output = tempArena.New<bool>(outputSize);
+		bool* quantizedOutput = tempArena.New<bool>(outputSize);
+
+		QuantizationDrift drift{};
+		drift.steps = length;
+		drift.firstMismatch = UINT32_MAX;
+
+		for (uint32_t i = 0; i < length; i++)
+		{
+			const float* input = &inputs[i * nnet.createInfo.inputSize];
+			Propagate(nnet, state, input, output);
+			Propagate(quantized, quantizedState, input, quantizedOutput);
+
+			for (uint32_t j = 0; j < outputSize; j++)
+			{
+				if (output[j] == quantizedOutput[j])
+					continue;
+				++drift.mismatches;
+				drift.firstMismatch = Min(drift.firstMismatch, i);
+			}
+		}
+
+		const uint32_t total = length * outputSize;
+		drift.rate = total > 0 ? static_cast<float>(drift.mismatches) / static_cast<float>(total) : 0;
+		tempArena.DestroyScope(tempScope);
+		return drift;
+	}
+}
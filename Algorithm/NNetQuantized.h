@@ -0,0 +1,66 @@
+#pragma once
+#include "NNetPlan.h"
+
+namespace jv::ai
+{
+	enum class Precision
+	{
+		// Half precision floats.
+		fp16,
+		// 8 bit integers with a scale factor per network.
+		int8
+	};
+
+	/*
+	Frozen copy of an execution plan that stores weights, thresholds and decays in reduced precision.
+	Thresholds and decays are expected to be positive, like Mutate guarantees.
+	*/
+	struct QuantizedNNet final
+	{
+		uint64_t scope;
+		Precision precision;
+		uint32_t inputSize;
+		uint32_t outputSize;
+		uint32_t neuronCount;
+		uint32_t edgeCount;
+		// Stored value times scale gives the original value. Always 1 for fp16.
+		float thresholdScale;
+		float decayScale;
+		float weightScale;
+		// Half floats for fp16. For int8, thresholds and decays are unsigned and weights are signed.
+		void* thresholds;
+		void* decays;
+		void* values;
+		// Outgoing edges of neuron i are in range [offsets[i], offsets[i + 1]).
+		uint32_t* offsets;
+		uint32_t* targets;
+	};
+
+	struct QuantizationDrift final
+	{
+		uint32_t steps;
+		// Amount of output values that differ from the original network.
+		uint32_t mismatches;
+		// First step with a differing output, UINT32_MAX if there is none.
+		uint32_t firstMismatch;
+		// Mismatches divided by the total amount of output values.
+		float rate;
+	};
+
+	__declspec(dllexport) [[nodiscard]] QuantizedNNet Quantize(const NNetPlan& plan, Precision precision, Arena& arena);
+	__declspec(dllexport) void DestroyQuantizedNNet(QuantizedNNet& nnet, Arena& arena);
+
+	// Forward information through the quantized network.
+	__declspec(dllexport) void Propagate(const QuantizedNNet& nnet, NNetState& state, const float* input, bool* output);
+
+	/*
+	Run both networks from a clean state over the same sequence of inputs and compare their outputs.
+	Inputs are laid out as [length][inputSize].
+	*/
+	__declspec(dllexport) [[nodiscard]] QuantizationDrift GetQuantizationDrift(const NNet& nnet, const QuantizedNNet& quantized,
+		const float* inputs, uint32_t length, Arena& tempArena);
+
+	// Convert to half precision, rounding to nearest even.
+	__declspec(dllexport) [[nodiscard]] uint16_t FloatToHalf(float value);
+	__declspec(dllexport) [[nodiscard]] float HalfToFloat(uint16_t value);
+}
@@ -1,6 +1,10 @@
 #include "pch.h"
 #include "NNetUtils.h"
+#include "Random.h"
+#include "NNetKernels.h"
 #include "Jlib/Math.h"
+#include <cfloat>
+#include <cmath>
 
 namespace jv::ai
 {
@@ -13,55 +17,79 @@ namespace jv::ai
 
 	Layer AddLayer(NNet& nnet, const uint32_t length, InitType initType, uint32_t& gId)
 	{
+		// Reserve all neurons at once, so that a layer is never added halfway.
+		if (nnet.neuronCount + length > nnet.createInfo.neuronCapacity)
+			return {};
+
 		for (uint32_t i = 0; i < length; i++)
 		{
-			bool valid = true;
 			switch (initType)
 			{
 			case InitType::flat:
-				valid = AddNeuron(nnet, 1, 0, gId);
+				AddNeuron(nnet, 1, 0, gId);
 				break;
 			case InitType::random:
-				valid = AddNeuron(nnet, jv::RandF(0, 1), jv::RandF(0, 1), gId);
+				AddNeuron(nnet, RandF(GetRandom()), RandF(GetRandom()), gId);
 				break;
 			default:
 				break;
 			}
-			assert(valid);
 		}
 			
 		return { nnet.neuronCount - length, nnet.neuronCount };
 	}
 
-	void Connect(NNet& nnet, Layer from, Layer to, InitType initType, uint32_t& gId)
+	bool Connect(NNet& nnet, Layer from, Layer to, InitType initType, uint32_t& gId)
 	{
+		assert(!nnet.sharesNeurons && !nnet.sharesWeights);
+		assert(from.to <= nnet.neuronCount && to.to <= nnet.neuronCount);
+		// Not allowed to add a weight with an input node as a destination.
+		assert(to.from >= nnet.createInfo.inputSize);
+
 		const uint32_t inSize = from.to - from.from;
 		const uint32_t outSize = to.to - to.from;
 
+		// Reserve all weights at once.
+		if (nnet.weightCount + inSize * outSize > nnet.createInfo.weightCapacity)
+			return false;
+		for (uint32_t i = 0; i < inSize; i++)
+			for (uint32_t j = 0; j < outSize; j++)
+				if (HasWeight(nnet, from.from + i, to.from + j))
+					return false;
+
+		// Lay out the weights as a row major matrix, with every row chained front to back.
 		for (uint32_t i = 0; i < inSize; i++)
+		{
+			auto& neuron = nnet.neurons[from.from + i];
+			const uint32_t rowStart = nnet.weightCount;
+
 			for (uint32_t j = 0; j < outSize; j++)
 			{
-				bool valid = true;
-				switch (initType)
-				{
-				case InitType::flat:
-					valid = AddWeight(nnet, from.from + i, to.from + j, 1, gId);
-					break;
-				case InitType::random:
-					valid = AddWeight(nnet, from.from + i, to.from + j, jv::RandF(-1, 1), gId);
-					break;
-				default:
-					break;
-				}
-				assert(valid);
-			}	
+				const uint32_t id = rowStart + j;
+				auto& weight = nnet.weights[id] = {};
+				auto& meta = nnet.weightMeta[id] = {};
+				meta.innovationId = gId++;
+				meta.from = from.from + i;
+				weight.to = to.from + j;
+				weight.value = initType == InitType::random ? RandF(GetRandom(), -1, 1) : 1;
+				weight.next = j + 1 < outSize ? id + 1 : neuron.weightsId;
+				AddEdge(nnet, meta.from, weight.to);
+			}
+
+			if (outSize > 0)
+				neuron.weightsId = rowStart;
+			nnet.weightCount += outSize;
+		}
+
+		nnet.coneValid = false;
+		return true;
 	}
 
-	void ConnectIO(NNet& nnet, const InitType initType, uint32_t& gId)
+	bool ConnectIO(NNet& nnet, const InitType initType, uint32_t& gId)
 	{
 		const uint32_t inSize = nnet.createInfo.inputSize;
 		const uint32_t outSize = nnet.createInfo.outputSize;
-		Connect(nnet, { 0, inSize }, { inSize, inSize + outSize }, initType, gId);
+		return Connect(nnet, { 0, inSize }, { inSize, inSize + outSize }, initType, gId);
 	}
 
 	float GetCompability(NNet& a, NNet& b)
@@ -72,261 +100,420 @@ namespace jv::ai
 
 		while (aC < a.weightCount && bC < b.weightCount)
 		{
-			auto& aW = a.weights[aC];
-			auto& bW = b.weights[bC];
+			const uint32_t aId = a.weightMeta[aC].innovationId;
+			const uint32_t bId = b.weightMeta[bC].innovationId;
 			
-			const bool eq = aW.innovationId == bW.innovationId;
+			const bool eq = aId == bId;
 			if (!eq)
 				++errorCount;
-			aC += aW.innovationId < bW.innovationId || eq;
-			bC += bW.innovationId < aW.innovationId || eq;
+			aC += aId < bId || eq;
+			bC += bId < aId || eq;
 		}
 		errorCount += a.weightCount - aC + b.weightCount - bC;
 		const auto res = 1.f - static_cast<float>(errorCount) / static_cast<float>(a.weightCount + b.weightCount);
 		return res;
 	}
-	NNet Breed(NNet& a, NNet& b, Arena& arena, Arena& tempArena)
-	{
-		const auto tempScope = tempArena.CreateScope();
-		NNetCreateInfo createInfo = a.createInfo;
-		createInfo.neuronCapacity += b.createInfo.neuronCapacity;
-		createInfo.weightCapacity += b.createInfo.weightCapacity;
-		auto tempNNet = CreateNNet(createInfo, tempArena);
-
-		uint32_t aC = 0;
-		uint32_t bC = 0;
-		uint32_t nC = 0;
 
-		// Ordered double insert for neurons.
-		while (aC < a.neuronCount && bC < b.neuronCount)
+	Signature CreateSignature(const NNet& nnet, Arena& arena)
+	{
+		Signature signature{};
+		signature.scope = arena.CreateScope();
+		signature.count = nnet.weightCount;
+		signature.ids = arena.New<uint32_t>(nnet.weightCount);
+		signature.values = arena.New<float>(nnet.weightCount);
+		for (uint32_t i = 0; i < nnet.weightCount; i++)
 		{
-			auto& aN = a.neurons[aC];
-			auto& bN = b.neurons[bC];
-
-			const bool eq = aN.innovationId == bN.innovationId;
-			auto& n = tempNNet.neurons[tempNNet.neuronCount++];
-
-			// Either add neuron from a, b or random.
-			if (aN.innovationId < bN.innovationId)
-				n = aN;
-			if (aN.innovationId == bN.innovationId)
-				n = rand() % 2 ? aN : bN;
-			if (aN.innovationId > bN.innovationId)
-				n = bN;
-
-			aC += aN.innovationId < bN.innovationId || eq;
-			bC += bN.innovationId < aN.innovationId || eq;
-			++nC;
+			signature.ids[i] = nnet.weightMeta[i].innovationId;
+			signature.values[i] = nnet.weights[i].value;
+			assert(i == 0 || signature.ids[i - 1] < signature.ids[i]);
 		}
-		while (aC < a.neuronCount)
-			tempNNet.neurons[tempNNet.neuronCount++] = a.neurons[aC++];
-		while (bC < b.neuronCount)
-			tempNNet.neurons[tempNNet.neuronCount++] = b.neurons[bC++];
-		
-		// Ordered double insert for weights.
-		// With the change that from/to will be replaced by the neuron's innovation id, so that it can be tracked
-		// despite the changed topology.
-		aC = bC = nC = 0;
-		while (aC < a.weightCount && bC < b.weightCount)
-		{
-			auto& aW = a.weights[aC];
-			auto& bW = b.weights[bC];
-
-			if (!aW.enabled)
-			{
-				++aC;
-				continue;
-			}
-			if (!bW.enabled)
-			{
-				++bC;
-				continue;
-			}
+		return signature;
+	}
 
-			const bool eq = aW.innovationId == bW.innovationId;
-			auto& w = tempNNet.weights[tempNNet.weightCount++];
+	void DestroySignature(Signature& signature, Arena& arena)
+	{
+		arena.DestroyScope(signature.scope);
+	}
 
-			NNet* n = nullptr;
+	float GetCompability(const Signature& a, const Signature& b, const float weightFactor)
+	{
+		const uint32_t total = a.count + b.count;
+		if (total == 0)
+			return 1;
+
+		float difference = 0;
+		const uint32_t matches = GetNeuronKernels().intersect(a.ids, a.values, a.count, b.ids, b.values, b.count, difference);
+		// Every mismatch is an error, so this equals one minus the error rate.
+		float res = static_cast<float>(matches * 2) / static_cast<float>(total);
+		if (weightFactor > 0 && matches > 0)
+			res = Max(res - weightFactor * difference / static_cast<float>(matches), 0.f);
+		return res;
+	}
 
-			// Either add neuron from a, b or random.
-			if (aW.innovationId < bW.innovationId)
-			{
-				n = &a;
-				w = aW;
-			}
-				
-			if (aW.innovationId == bW.innovationId)
-			{
-				const uint32_t r = rand() % 2;
-				n = r ? &a : &b;
-				w = r ? aW : bW;
-			}
-			if (aW.innovationId > bW.innovationId)
+	// Flag the weights that are reached when propagating. Disabled and cut off weights are not passed on.
+	static bool* GetExpressedWeights(const NNet& nnet, Arena& tempArena)
+	{
+		bool* expressed = tempArena.New<bool>(nnet.weightCount);
+		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+		{
+			uint32_t weightId = nnet.neurons[i].weightsId;
+			while (weightId != UINT32_MAX)
 			{
-				n = &b;
-				w = bW;
+				expressed[weightId] = true;
+				weightId = nnet.weights[weightId].next;
 			}
+		}
+		return expressed;
+	}
 
-			w.from = n->neurons[w.from].innovationId;
-			w.to = n->neurons[w.to].innovationId;
-			w.next = w.next == UINT32_MAX ? w.next : n->weights[w.next].innovationId;
+	/*
+	Merge the neurons of both parents by innovation id and store the index of each parent neuron in the child.
+	Input and output neurons are matched by position instead, since unrelated networks don't share their ids.
+	Only counts the neurons if child is null.
+	*/
+	static uint32_t MergeNeurons(const NNet& a, const NNet& b, uint32_t* aMap, uint32_t* bMap, NNet* child)
+	{
+		const uint32_t ioSize = a.createInfo.inputSize + a.createInfo.outputSize;
+		uint32_t count = 0;
 
-			aC += aW.innovationId < bW.innovationId || eq;
-			bC += bW.innovationId < aW.innovationId || eq;
-			++nC;
-		}
-		while (aC < a.weightCount)
-		{
-			auto& w = tempNNet.weights[tempNNet.weightCount++];
-			auto& aW = a.weights[aC++];
-			w = aW;
-			w.from = a.neurons[aW.from].innovationId;
-			w.to = a.neurons[aW.to].innovationId;
-			w.next = w.next == UINT32_MAX ? w.next : a.weights[w.next].innovationId;
-		}
-			
-		while (bC < b.weightCount)
+		for (; count < ioSize; count++)
 		{
-			auto& w = tempNNet.weights[tempNNet.weightCount++];
-			auto& bW = b.weights[bC++];
-			w = bW;
-			w.from = b.neurons[bW.from].innovationId;
-			w.to = b.neurons[bW.to].innovationId;
-			w.next = w.next == UINT32_MAX ? w.next : b.weights[w.next].innovationId;
+			aMap[count] = bMap[count] = count;
+			if (!child)
+				continue;
+			const bool fromA = RandU(GetRandom(), 2);
+			child->neurons[count] = fromA ? a.neurons[count] : b.neurons[count];
+			child->neuronMeta[count] = a.neuronMeta[count];
 		}
 
-		// Now change the neuron weight starts AND the weight from/to's, as well as the nexts.
-		for (uint32_t i = 0; i < tempNNet.neuronCount; i++)
-			tempNNet.neurons[i].weightsId = UINT32_MAX;
-
-		for (int32_t i = tempNNet.weightCount - 1; i >= 0; i--)
+		uint32_t aC = ioSize;
+		uint32_t bC = ioSize;
+		while (aC < a.neuronCount || bC < b.neuronCount)
 		{
-			auto& weight = tempNNet.weights[i];
+			const uint32_t aId = aC < a.neuronCount ? a.neuronMeta[aC].innovationId : UINT32_MAX;
+			const uint32_t bId = bC < b.neuronCount ? b.neuronMeta[bC].innovationId : UINT32_MAX;
+			const bool eq = aId == bId;
 
-			// Connect to neurons.
-			for (uint32_t j = 0; j < tempNNet.neuronCount; j++)
+			if (child)
 			{
-				auto& neuron = tempNNet.neurons[j];
-				if (neuron.innovationId == weight.from)
-				{
-					weight.from = j;
-					neuron.weightsId = i;
-				}
-				if (neuron.innovationId == weight.to)
-					weight.to = j;
+				// Either add neuron from a, b or random.
+				const bool fromA = aId < bId || (eq && RandU(GetRandom(), 2));
+				child->neurons[count] = fromA ? a.neurons[aC] : b.neurons[bC];
+				child->neuronMeta[count] = fromA ? a.neuronMeta[aC] : b.neuronMeta[bC];
 			}
 
-			// Connect all weights.
-			if (weight.next == UINT32_MAX)
-				continue;
+			if (aId <= bId)
+				aMap[aC++] = count;
+			if (bId <= aId)
+				bMap[bC++] = count;
+			++count;
+		}
+		return count;
+	}
+
+	/*
+	Merge the expressed weights of both parents by innovation id. Only counts the weights if child is null.
+	Weights that connect the same neurons as an older weight are left out of the child, which can happen for unrelated
+	parents. The count is an upper bound because of that.
+	*/
+	static uint32_t MergeWeights(const NNet& a, const NNet& b, const bool* aExpressed, const bool* bExpressed,
+		const uint32_t* aMap, const uint32_t* bMap, NNet* child)
+	{
+		uint32_t count = 0;
+		uint32_t aC = 0;
+		uint32_t bC = 0;
+
+		while (true)
+		{
+			while (aC < a.weightCount && !aExpressed[aC])
+				++aC;
+			while (bC < b.weightCount && !bExpressed[bC])
+				++bC;
+			if (aC == a.weightCount && bC == b.weightCount)
+				break;
+
+			const uint32_t aId = aC < a.weightCount ? a.weightMeta[aC].innovationId : UINT32_MAX;
+			const uint32_t bId = bC < b.weightCount ? b.weightMeta[bC].innovationId : UINT32_MAX;
+			const bool eq = aId == bId;
 
-			for (int32_t j = i - 1; j >= 0; j--)
+			if (child)
 			{
-				auto& oWeight = tempNNet.weights[j];
-				if (oWeight.innovationId == weight.next)
+				// Either add weight from a, b or random.
+				const bool fromA = aId < bId || (eq && RandU(GetRandom(), 2));
+				const NNet& parent = fromA ? a : b;
+				const uint32_t* map = fromA ? aMap : bMap;
+				const uint32_t id = fromA ? aC : bC;
+
+				const uint32_t from = map[parent.weightMeta[id].from];
+				const uint32_t to = map[parent.weights[id].to];
+				if (AddEdge(*child, from, to))
 				{
-					weight.next = j;
-					break;
+					auto& weight = child->weights[count] = {};
+					auto& meta = child->weightMeta[count++] = {};
+					weight.value = parent.weights[id].value;
+					weight.to = to;
+					meta.innovationId = parent.weightMeta[id].innovationId;
+					meta.from = from;
 				}
 			}
+			else
+				++count;
+
+			aC += aId <= bId;
+			bC += bId <= aId;
 		}
+		return count;
+	}
+
+	NNet Breed(NNet& a, NNet& b, Arena& arena, Arena& tempArena)
+	{
+		assert(a.createInfo.inputSize == b.createInfo.inputSize);
+		assert(a.createInfo.outputSize == b.createInfo.outputSize);
+		const auto tempScope = tempArena.CreateScope();
 
-		// temp
-		for (size_t i = 0; i < tempNNet.weightCount; i++)
+		uint32_t* aMap = tempArena.New<uint32_t>(a.neuronCount);
+		uint32_t* bMap = tempArena.New<uint32_t>(b.neuronCount);
+		const bool* aExpressed = GetExpressedWeights(a, tempArena);
+		const bool* bExpressed = GetExpressedWeights(b, tempArena);
+
+		// Count first, so that the child doesn't have to be allocated at the worst case size.
+		const uint32_t neuronCount = MergeNeurons(a, b, aMap, bMap, nullptr);
+		const uint32_t weightCount = MergeWeights(a, b, aExpressed, bExpressed, aMap, bMap, nullptr);
+
+		// Make sure it can still mutate once.
+		NNetCreateInfo createInfo = a.createInfo;
+		createInfo.neuronCapacity = neuronCount + 1;
+		createInfo.weightCapacity = weightCount + 3;
+		auto child = CreateNNet(createInfo, arena);
+		child.neuronCount = MergeNeurons(a, b, aMap, bMap, &child);
+		child.weightCount = MergeWeights(a, b, aExpressed, bExpressed, aMap, bMap, &child);
+
+		// Rebuild the chains the same way AddWeight builds them, newest weight first.
+		for (uint32_t i = 0; i < child.neuronCount; i++)
+			child.neurons[i].weightsId = UINT32_MAX;
+		for (uint32_t i = 0; i < child.weightCount; i++)
 		{
-			auto& weight = tempNNet.weights[i];
-			assert(weight.from < tempNNet.neuronCount);
-			assert(weight.to < tempNNet.neuronCount);
-			assert(weight.next < tempNNet.weightCount || weight.next == UINT32_MAX);
+			auto& neuron = child.neurons[child.weightMeta[i].from];
+			child.weights[i].next = neuron.weightsId;
+			neuron.weightsId = i;
 		}
 
-		// Copy and optimize size, but still make sure it can mutate once.
-		createInfo.neuronCapacity = tempNNet.neuronCount + 1;
-		createInfo.weightCapacity = tempNNet.weightCount + 3;
-		auto childNNet = CreateNNet(createInfo, arena);
-		Copy(tempNNet, childNNet);
-
 		tempArena.DestroyScope(tempScope);
-		return childNNet;
+		return child;
 	}
 
-	void Mutate(NNet& nnet, const Mutations mutations, uint32_t& gId)
+	MutationDelta CreateMutationDelta(const NNet& nnet, Arena& arena)
 	{
-		auto& weightMut = mutations.weight;
-		if (weightMut.chance > 0)
-		{
-			for (size_t i = 0; i < nnet.weightCount; i++)
-			{
-				if (RandF(0, 1) > weightMut.chance)
-					continue;
+		MutationDelta delta{};
+		delta.scope = arena.CreateScope();
+		delta.weights = arena.New<uint32_t>(nnet.createInfo.weightCapacity);
+		// Threshold and decay are tracked separately.
+		delta.neurons = arena.New<uint32_t>(nnet.createInfo.neuronCapacity * 2);
+		return delta;
+	}
 
-				auto& weight = nnet.weights[i];
-				// 1 = new value, 2 = percent wise, 3 = linear addition/subtraction.
-				uint32_t type = rand() % 3;
-				weight.value = type != 0 || !mutations.weight.canRandomize ? weight.value : RandF(-1, 1);
-				weight.value = type != 1 ? weight.value : weight.value * 
-					RandF(1.f - weightMut.pctAlpha, 1.f + weightMut.pctAlpha);
-				weight.value = type != 2 ? weight.value : weight.value + RandF(-1, 1) * weightMut.linAlpha;
-			}
+	void DestroyMutationDelta(MutationDelta& delta, Arena& arena)
+	{
+		arena.DestroyScope(delta.scope);
+	}
+
+	/*
+	Take the weight out of the chain of its neuron. The weights that followed it in the chain are cut off as well,
+	since the split that disables a weight always has.
+	*/
+	static void Disable(NNet& nnet, const uint32_t weightId)
+	{
+		auto& meta = nnet.weightMeta[weightId];
+		uint32_t* link = &nnet.neurons[meta.from].weightsId;
+		while (*link != UINT32_MAX && *link != weightId)
+			link = &nnet.weights[*link].next;
+		*link = UINT32_MAX;
+
+		nnet.weights[weightId].next = UINT32_MAX;
+		meta.enabled = false;
+		nnet.coneValid = false;
+	}
+
+	// Amount of random pairs of neurons tried when adding a weight.
+	constexpr uint32_t NEW_WEIGHT_ATTEMPTS = 8;
+	// Amount of values that are mutated together.
+	constexpr uint32_t MUTATION_BATCH_SIZE = 64;
+
+	/*
+	Mutate every count-th float with the given chance, starting at values and stepping with stride.
+	Instead of rolling for every value, the gap to the next mutated value is drawn from a geometric distribution.
+	Each type of mutation is written as value * mul + add, so that a batch of values can be updated in one go.
+	Indices of the mutated values are stored in changed if it isn't null.
+	The values are only requested once something is actually mutated, since that may have to unshare them.
+	*/
+	static void MutateValues(Random& random, NNet& nnet, Arena* arena, float* (*getValues)(NNet&, Arena*),
+		const uint32_t stride, const uint32_t count, const Mutation& mutation, const float randomMin, const float randomMax,
+		const float min, const float max, uint32_t* changed, uint32_t& changedCount)
+	{
+		if (mutation.chance <= 0 || count == 0)
+			return;
+
+		// Chances of 1 or more give a gap of 0.
+		double logMiss = -HUGE_VAL;
+		if (mutation.chance < 1)
+		{
+			// Stagnation keeps shrinking the chance, which log(1 - chance) would round to 0 after long enough.
+			logMiss = log1p(-static_cast<double>(mutation.chance));
+			if (logMiss == 0 || !std::isfinite(logMiss))
+				return;
 		}
-		auto& thresholdMut = mutations.threshold;
-		if (thresholdMut.chance > 0)
+		uint32_t indices[MUTATION_BATCH_SIZE];
+		float muls[MUTATION_BATCH_SIZE];
+		float adds[MUTATION_BATCH_SIZE];
+
+		uint64_t i = 0;
+		while (true)
 		{
-			for (size_t i = 0; i < nnet.neuronCount; i++)
+			uint32_t batchSize = 0;
+			for (; batchSize < MUTATION_BATCH_SIZE; batchSize++)
 			{
-				if (RandF(0, 1) > thresholdMut.chance)
-					continue;
-
-				auto& neuron = nnet.neurons[i];
-				uint32_t type = rand() % 3;
-				neuron.threshold = type != 0 || !mutations.threshold.canRandomize ? neuron.threshold : RandF(0, 1);
-				neuron.threshold = type != 1 ? neuron.threshold : neuron.threshold *
-					RandF(1.f - thresholdMut.pctAlpha, 1.f + thresholdMut.pctAlpha);
-				neuron.threshold = type != 2 ? neuron.threshold : neuron.threshold + RandF(-1, 1) * thresholdMut.linAlpha;
-				neuron.threshold = Max<float>(neuron.threshold, .1);
+				// 1 - u is in (0, 1], so the log is always finite. The gap can still be too large to convert for tiny chances.
+				const double gap = log(1.0 - RandF(random)) / logMiss;
+				if (gap >= static_cast<double>(count - i))
+					break;
+				i += static_cast<uint64_t>(gap);
+				indices[batchSize] = static_cast<uint32_t>(i++);
 			}
-		}
-		auto& decayMut = mutations.decay;
-		if (decayMut.chance > 0)
-		{
-			for (size_t i = 0; i < nnet.neuronCount; i++)
+
+			// 0 = new value, 1 = percent wise, 2 = linear addition/subtraction.
+			for (uint32_t j = 0; j < batchSize; j++)
 			{
-				if (RandF(0, 1) > decayMut.chance)
-					continue;
+				const uint32_t type = RandU(random, 3);
+				const float r = RandF(random);
+				const bool randomize = type == 0 && mutation.canRandomize;
+				muls[j] = randomize ? 0 : type == 1 ? 1.f + (r * 2 - 1) * mutation.pctAlpha : 1;
+				adds[j] = randomize ? randomMin + r * (randomMax - randomMin) : type == 2 ? (r * 2 - 1) * mutation.linAlpha : 0;
+			}
 
-				auto& neuron = nnet.neurons[i];
-				uint32_t type = rand() % 3;
-				neuron.decay = type != 0 || !mutations.decay.canRandomize ? neuron.decay : RandF(0, 1);
-				neuron.decay = type != 1 ? neuron.decay : neuron.decay *
-					RandF(1.f - decayMut.pctAlpha, 1.f + decayMut.pctAlpha);
-				neuron.decay = type != 2 ? neuron.decay : neuron.decay + RandF(-1, 1) * decayMut.linAlpha;
-				neuron.decay = Clamp<float>(neuron.decay, 0, .9);
+			float* values = batchSize > 0 ? getValues(nnet, arena) : nullptr;
+			for (uint32_t j = 0; j < batchSize; j++)
+			{
+				float& value = values[static_cast<size_t>(indices[j]) * stride];
+				value = Clamp<float>(value * muls[j] + adds[j], min, max);
 			}
+
+			if (changed)
+				for (uint32_t j = 0; j < batchSize; j++)
+					changed[changedCount++] = indices[j];
+
+			if (batchSize < MUTATION_BATCH_SIZE)
+				break;
 		}
-		if (RandF(0, 1) < mutations.newNodeChance && nnet.weightCount < nnet.createInfo.weightCapacity && nnet.weightCount > 0)
+	}
+
+	// Give the network its own neurons if they are still shared with another network.
+	static void UnshareNeurons(NNet& nnet, Arena* arena)
+	{
+		if (!nnet.sharesNeurons)
+			return;
+		assert(arena);
+
+		const auto neurons = arena->New<Neuron>(nnet.createInfo.neuronCapacity);
+		const auto neuronMeta = arena->New<NeuronMeta>(nnet.createInfo.neuronCapacity);
+		memcpy(neurons, nnet.neurons, sizeof(Neuron) * nnet.neuronCount);
+		memcpy(neuronMeta, nnet.neuronMeta, sizeof(NeuronMeta) * nnet.neuronCount);
+		nnet.neurons = neurons;
+		nnet.neuronMeta = neuronMeta;
+		nnet.sharesNeurons = false;
+	}
+
+	static void UnshareWeights(NNet& nnet, Arena* arena)
+	{
+		if (!nnet.sharesWeights)
+			return;
+		assert(arena);
+
+		const auto weights = arena->New<Weight>(nnet.createInfo.weightCapacity);
+		const auto weightMeta = arena->New<WeightMeta>(nnet.createInfo.weightCapacity);
+		memcpy(weights, nnet.weights, sizeof(Weight) * nnet.weightCount);
+		memcpy(weightMeta, nnet.weightMeta, sizeof(WeightMeta) * nnet.weightCount);
+		nnet.weights = weights;
+		nnet.weightMeta = weightMeta;
+		nnet.sharesWeights = false;
+		CreateEdgeIndex(nnet, *arena);
+		UpdateEdgeIndex(nnet);
+	}
+
+	static float* GetWeightValues(NNet& nnet, Arena* arena)
+	{
+		UnshareWeights(nnet, arena);
+		return &nnet.weights[0].value;
+	}
+
+	static float* GetThresholds(NNet& nnet, Arena* arena)
+	{
+		UnshareNeurons(nnet, arena);
+		return &nnet.neurons[0].threshold;
+	}
+
+	static float* GetDecays(NNet& nnet, Arena* arena)
+	{
+		UnshareNeurons(nnet, arena);
+		return &nnet.neurons[0].decay;
+	}
+
+	void Mutate(NNet& nnet, const Mutations mutations, uint32_t& gId, MutationDelta* delta, Arena* arena)
+	{
+		MutationDelta ignored{};
+		auto& changes = delta ? *delta : ignored;
+		changes.weightCount = 0;
+		changes.neuronCount = 0;
+		changes.splitWeight = UINT32_MAX;
+
+		auto& random = GetRandom();
+		MutateValues(random, nnet, arena, GetWeightValues, sizeof(Weight) / sizeof(float), nnet.weightCount,
+			mutations.weight, -1, 1, -FLT_MAX, FLT_MAX, delta ? changes.weights : nullptr, changes.weightCount);
+		MutateValues(random, nnet, arena, GetThresholds, sizeof(Neuron) / sizeof(float), nnet.neuronCount,
+			mutations.threshold, 0, 1, .1f, FLT_MAX, delta ? changes.neurons : nullptr, changes.neuronCount);
+		MutateValues(random, nnet, arena, GetDecays, sizeof(Neuron) / sizeof(float), nnet.neuronCount,
+			mutations.decay, 0, 1, 0, .9f, delta ? changes.neurons : nullptr, changes.neuronCount);
+
+		changes.firstNewNeuron = nnet.neuronCount;
+		changes.firstNewWeight = nnet.weightCount;
+		if (RandF(random) < mutations.newNodeChance && nnet.weightCount < nnet.createInfo.weightCapacity && nnet.weightCount > 0)
 		{
-			bool valid = AddNeuron(nnet, RandF(0, 1), RandF(0, 1), gId);
+			UnshareNeurons(nnet, arena);
+			UnshareWeights(nnet, arena);
+			bool valid = AddNeuron(nnet, RandF(random), RandF(random), gId);
 			if (valid)
 			{
-				const uint32_t weightId = rand() % nnet.weightCount;
-				auto& weight = nnet.weights[weightId];
-				weight.enabled = false;
-				weight.next = UINT32_MAX;
-				AddWeight(nnet, weight.from, nnet.neuronCount - 1, weight.value, gId);
+				const uint32_t weightId = RandU(random, nnet.weightCount);
+				Disable(nnet, weightId);
+				changes.splitWeight = weightId;
+				const auto& weight = nnet.weights[weightId];
+				AddWeight(nnet, nnet.weightMeta[weightId].from, nnet.neuronCount - 1, weight.value, gId);
 				AddWeight(nnet, nnet.neuronCount - 1, weight.to, 1, gId);
 			}
 		}
-		if (RandF(0, 1) < mutations.newWeightChance)
+		if (RandF(random) < mutations.newWeightChance)
 		{
-			// Minimize the impact this weight has on the network itself, making it mostly a topology based evolution.
-			AddWeight(nnet, rand() % nnet.neuronCount, nnet.createInfo.inputSize + rand() %
-				(nnet.neuronCount - nnet.createInfo.inputSize), RandF(-.1, .1), gId);
+			// Pairs that are already connected are skipped, but a dense network might not have any free pairs left.
+			for (uint32_t i = 0; i < NEW_WEIGHT_ATTEMPTS; i++)
+			{
+				const uint32_t from = RandU(random, nnet.neuronCount);
+				const uint32_t to = nnet.createInfo.inputSize + RandU(random, nnet.neuronCount - nnet.createInfo.inputSize);
+				if (HasWeight(nnet, from, to))
+					continue;
+
+				// Minimize the impact this weight has on the network itself, making it mostly a topology based evolution.
+				UnshareNeurons(nnet, arena);
+				UnshareWeights(nnet, arena);
+				AddWeight(nnet, from, to, RandF(random, -.1f, .1f), gId);
+				break;
+			}
 		}
 			
 	}
 
 	void Copy(NNet& org, NNet& dst, Arena* arena)
 	{
+		// Without an arena the arrays of dst are overwritten, which isn't allowed if they are shared.
+		assert(arena || (!dst.sharesNeurons && !dst.sharesWeights));
 		if (arena)
 		{
 			dst.scope = arena->CreateScope();
@@ -334,12 +521,215 @@ namespace jv::ai
 			dst.createInfo.neuronCapacity = org.neuronCount + 1;
 			dst.createInfo.weightCapacity = org.weightCount + 3;
 			dst.neurons = arena->New<Neuron>(dst.createInfo.neuronCapacity);
-			dst.weights = arena->New<Weight>(org.createInfo.weightCapacity);
+			dst.weights = arena->New<Weight>(dst.createInfo.weightCapacity);
+			dst.neuronMeta = arena->New<NeuronMeta>(dst.createInfo.neuronCapacity);
+			dst.weightMeta = arena->New<WeightMeta>(dst.createInfo.weightCapacity);
+			dst.state = CreateNNetState(dst, *arena);
+			dst.cone = arena->New<uint32_t>(dst.createInfo.neuronCapacity);
+			dst.sharesNeurons = false;
+			dst.sharesWeights = false;
+			CreateEdgeIndex(dst, *arena);
 		}
 
 		dst.neuronCount = org.neuronCount;
 		dst.weightCount = org.weightCount;
 		memcpy(dst.neurons, org.neurons, sizeof(Neuron) * org.neuronCount);
 		memcpy(dst.weights, org.weights, sizeof(Weight) * org.weightCount);
+		memcpy(dst.neuronMeta, org.neuronMeta, sizeof(NeuronMeta) * org.neuronCount);
+		memcpy(dst.weightMeta, org.weightMeta, sizeof(WeightMeta) * org.weightCount);
+		memcpy(dst.state.values, org.state.values, sizeof(float) * org.neuronCount);
+		memcpy(dst.cone, org.cone, sizeof(uint32_t) * org.coneCount * org.coneValid);
+		dst.coneCount = org.coneCount;
+		dst.coneValid = org.coneValid;
+		UpdateEdgeIndex(dst);
+	}
+
+	// Mix a 32 bit word into a hash, FNV-1a style but a word at a time.
+	[[nodiscard]] static uint64_t MixHash(const uint64_t hash, const uint32_t word)
+	{
+		return (hash ^ word) * 0x100000001b3;
+	}
+
+	// Floats are hashed by their bits.
+	[[nodiscard]] static uint32_t GetBits(const float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(float));
+		return bits;
+	}
+
+	uint64_t GetHash(const NNet& nnet)
+	{
+		uint64_t hash = 0xcbf29ce484222325;
+		hash = MixHash(hash, nnet.createInfo.inputSize);
+		hash = MixHash(hash, nnet.createInfo.outputSize);
+		hash = MixHash(hash, nnet.neuronCount);
+		hash = MixHash(hash, nnet.weightCount);
+
+		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+		{
+			const auto& neuron = nnet.neurons[i];
+			hash = MixHash(hash, GetBits(neuron.decay));
+			hash = MixHash(hash, GetBits(neuron.threshold));
+			hash = MixHash(hash, neuron.weightsId);
+		}
+
+		for (uint32_t i = 0; i < nnet.weightCount; i++)
+		{
+			const auto& weight = nnet.weights[i];
+			hash = MixHash(hash, GetBits(weight.value));
+			hash = MixHash(hash, weight.to);
+			hash = MixHash(hash, weight.next);
+		}
+
+		// Spread the last words over all bits.
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccd;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+	void Share(NNet& org, NNet& dst, Arena& arena)
+	{
+		dst = org;
+		dst.scope = arena.CreateScope();
+		// Make sure it can mutate once, like a copy.
+		dst.createInfo.neuronCapacity = org.neuronCount + 1;
+		dst.createInfo.weightCapacity = org.weightCount + 3;
+		dst.sharesNeurons = true;
+		dst.sharesWeights = true;
+
+		dst.state = CreateNNetState(dst, arena);
+		dst.cone = arena.New<uint32_t>(dst.createInfo.neuronCapacity);
+		memcpy(dst.state.values, org.state.values, sizeof(float) * org.neuronCount);
+		memcpy(dst.cone, org.cone, sizeof(uint32_t) * org.coneCount * org.coneValid);
+	}
+
+	void Unshare(NNet& nnet, Arena& arena)
+	{
+		UnshareNeurons(nnet, &arena);
+		UnshareWeights(nnet, &arena);
+	}
+
+	NNet Prune(NNet& nnet, Arena& arena, Arena& tempArena)
+	{
+		const auto tempScope = tempArena.CreateScope();
+		const uint32_t ioSize = nnet.createInfo.inputSize + nnet.createInfo.outputSize;
+
+		// Find the weights that are actually reached when propagating.
+		bool* active = tempArena.New<bool>(nnet.weightCount);
+		uint32_t* incomingCounts = tempArena.New<uint32_t>(nnet.neuronCount + 1);
+		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+		{
+			uint32_t weightId = nnet.neurons[i].weightsId;
+			while (weightId != UINT32_MAX)
+			{
+				const auto& weight = nnet.weights[weightId];
+				active[weightId] = true;
+				++incomingCounts[weight.to + 1];
+				weightId = weight.next;
+			}
+		}
+
+		// Group the active weights by destination.
+		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+			incomingCounts[i + 1] += incomingCounts[i];
+		uint32_t* incoming = tempArena.New<uint32_t>(incomingCounts[nnet.neuronCount]);
+		uint32_t* fill = tempArena.New<uint32_t>(nnet.neuronCount);
+		for (uint32_t i = 0; i < nnet.weightCount; i++)
+		{
+			if (!active[i])
+				continue;
+			const uint32_t to = nnet.weights[i].to;
+			incoming[incomingCounts[to] + fill[to]++] = i;
+		}
+
+		// Walk backwards from the output neurons.
+		bool* live = tempArena.New<bool>(nnet.neuronCount);
+		uint32_t* open = tempArena.New<uint32_t>(nnet.neuronCount);
+		uint32_t openCount = 0;
+		for (uint32_t i = nnet.createInfo.inputSize; i < ioSize; i++)
+		{
+			live[i] = true;
+			open[openCount++] = i;
+		}
+		while (openCount > 0)
+		{
+			const uint32_t id = open[--openCount];
+			for (uint32_t i = incomingCounts[id]; i < incomingCounts[id + 1]; i++)
+			{
+				const uint32_t from = nnet.weightMeta[incoming[i]].from;
+				if (live[from])
+					continue;
+				live[from] = true;
+				open[openCount++] = from;
+			}
+		}
+
+		// Input and output neurons are always kept, so that the layout of the network stays intact.
+		uint32_t* neuronMap = tempArena.New<uint32_t>(nnet.neuronCount);
+		uint32_t neuronCount = 0;
+		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+			neuronMap[i] = i < ioSize || live[i] ? neuronCount++ : UINT32_MAX;
+
+		// A weight is only useful if its destination can reach an output.
+		uint32_t* weightMap = tempArena.New<uint32_t>(nnet.weightCount);
+		uint32_t weightCount = 0;
+		for (uint32_t i = 0; i < nnet.weightCount; i++)
+			weightMap[i] = active[i] && live[nnet.weights[i].to] ? weightCount++ : UINT32_MAX;
+
+		// Make sure it can still mutate once.
+		NNetCreateInfo createInfo = nnet.createInfo;
+		createInfo.neuronCapacity = neuronCount + 1;
+		createInfo.weightCapacity = weightCount + 3;
+		auto pruned = CreateNNet(createInfo, arena);
+		pruned.neuronCount = neuronCount;
+		pruned.weightCount = weightCount;
+
+		for (uint32_t i = 0; i < nnet.neuronCount; i++)
+		{
+			if (neuronMap[i] == UINT32_MAX)
+				continue;
+
+			auto& neuron = pruned.neurons[neuronMap[i]] = nnet.neurons[i];
+			neuron.weightsId = UINT32_MAX;
+			pruned.neuronMeta[neuronMap[i]] = nnet.neuronMeta[i];
+			pruned.state.values[neuronMap[i]] = nnet.state.values[i];
+
+			// Relink the remaining weights in their original order.
+			uint32_t* link = &neuron.weightsId;
+			uint32_t weightId = nnet.neurons[i].weightsId;
+			while (weightId != UINT32_MAX)
+			{
+				const uint32_t id = weightMap[weightId];
+				if (id != UINT32_MAX)
+				{
+					*link = id;
+					link = &pruned.weights[id].next;
+				}
+				weightId = nnet.weights[weightId].next;
+			}
+			*link = UINT32_MAX;
+		}
+
+		for (uint32_t i = 0; i < nnet.weightCount; i++)
+		{
+			const uint32_t id = weightMap[i];
+			if (id == UINT32_MAX)
+				continue;
+
+			auto& weight = pruned.weights[id];
+			auto& meta = pruned.weightMeta[id];
+			const auto& org = nnet.weights[i];
+			weight.value = org.value;
+			weight.to = neuronMap[org.to];
+			meta.from = neuronMap[nnet.weightMeta[i].from];
+			meta.innovationId = nnet.weightMeta[i].innovationId;
+			meta.enabled = true;
+		}
+		UpdateEdgeIndex(pruned);
+
+		tempArena.DestroyScope(tempScope);
+		return pruned;
 	}
-}
\ No newline at end of file
+}
@@ -31,6 +31,35 @@ namespace jv::ai
 		float newWeightChance = 0;
 	};
 
+	/*
+	Everything a call to Mutate changed, so that derived forms of the network like execution plans can be patched
+	instead of rebuilt. Changed values are not stored, they are read back from the network.
+	*/
+	struct MutationDelta final
+	{
+		uint64_t scope;
+		// Weights with a changed value.
+		uint32_t* weights;
+		uint32_t weightCount;
+		// Neurons with a changed threshold or decay.
+		uint32_t* neurons;
+		uint32_t neuronCount;
+		// Weight that was disabled by splitting it, UINT32_MAX if no split happened.
+		uint32_t splitWeight;
+		// Neurons and weights from these indices onwards were added.
+		uint32_t firstNewNeuron;
+		uint32_t firstNewWeight;
+	};
+
+	// Innovation ids and values of all weights of a network, sorted by id. Made once to compare a network to many others.
+	struct Signature final
+	{
+		uint64_t scope;
+		uint32_t* ids;
+		float* values;
+		uint32_t count;
+	};
+
 	enum class InitType 
 	{
 		flat,
@@ -42,16 +71,58 @@ namespace jv::ai
 	Returns the input layer.
 	*/
 	__declspec(dllexport) IOLayers Init(NNet& nnet, InitType initType, uint32_t& gId);
-	// Adds a new layer of neurons.
+	// Adds a new layer of neurons. Returns an empty layer if it doesn't fit.
 	__declspec(dllexport) Layer AddLayer(NNet& nnet, uint32_t length, InitType initType, uint32_t& gId);
-	__declspec(dllexport) void Connect(NNet& nnet, Layer from, Layer to, InitType initType, uint32_t& gId);
+	/*
+	Fully connect two layers. The weights are stored as one dense row major block, which CompileNNet turns into a
+	matrix vector product. Returns false without changing the network if the weights don't fit or if any of the
+	neurons are already connected.
+	*/
+	__declspec(dllexport) bool Connect(NNet& nnet, Layer from, Layer to, InitType initType, uint32_t& gId);
 	// Connect the input and output layers.
-	__declspec(dllexport) void ConnectIO(NNet& nnet, InitType initType, uint32_t& gId);
+	__declspec(dllexport) bool ConnectIO(NNet& nnet, InitType initType, uint32_t& gId);
 
 	__declspec(dllexport) [[nodiscard]] float GetCompability(NNet& a, NNet& b);
+	__declspec(dllexport) [[nodiscard]] Signature CreateSignature(const NNet& nnet, Arena& arena);
+	__declspec(dllexport) void DestroySignature(Signature& signature, Arena& arena);
+	/*
+	Same as comparing the networks directly, but uses the SIMD kernels. Returns 1 for identical structure.
+	If weightFactor is set, the average weight difference of the shared weights is subtracted like in NEAT.
+	*/
+	__declspec(dllexport) [[nodiscard]] float GetCompability(const Signature& a, const Signature& b, float weightFactor = 0);
+	/*
+	Create a child with the genes of both parents, matched by innovation id. Matching genes are picked at random.
+	Only weights that are reached when propagating are passed on. Runs in linear time.
+	*/
 	__declspec(dllexport) [[nodiscard]] NNet Breed(NNet& a, NNet& b, Arena& arena, Arena& tempArena);
 
-	__declspec(dllexport) void Mutate(NNet& nnet, Mutations mutations, uint32_t& gId);
+	// Create a delta that can track the mutations of the network or any copy of it with the same capacity.
+	__declspec(dllexport) [[nodiscard]] MutationDelta CreateMutationDelta(const NNet& nnet, Arena& arena);
+	__declspec(dllexport) void DestroyMutationDelta(MutationDelta& delta, Arena& arena);
+	/*
+	Optionally records the changes in delta.
+	Shared arrays are copied into the arena before they are changed, so it is required when mutating a shared network.
+	*/
+	__declspec(dllexport) void Mutate(NNet& nnet, Mutations mutations, uint32_t& gId, 
+		MutationDelta* delta = nullptr, Arena* arena = nullptr);
 	__declspec(dllexport) void Copy(NNet& org, NNet& dst, Arena* arena = nullptr);
+	/*
+	Hash of everything that influences propagation: the structure, including the order of the chains, and all parameters.
+	Copies and shared networks have the same hash. The current neuron values are not included.
+	*/
+	__declspec(dllexport) [[nodiscard]] uint64_t GetHash(const NNet& nnet);
+	/*
+	Create a copy that uses the neurons and weights of the original until they are changed by Mutate.
+	The original has to outlive the copy and should not be changed while it is shared.
+	*/
+	__declspec(dllexport) void Share(NNet& org, NNet& dst, Arena& arena);
+	// Give the network its own neurons and weights, for instance before changing it by hand.
+	__declspec(dllexport) void Unshare(NNet& nnet, Arena& arena);
+	/*
+	Create a compact copy of the network that only contains the structure that can influence the output.
+	Drops disabled weights, weights that are no longer reached when propagating, and neurons without a path to an output neuron.
+	Innovation ids are kept intact for crossover.
+	*/
+	__declspec(dllexport) [[nodiscard]] NNet Prune(NNet& nnet, Arena& arena, Arena& tempArena);
 }
 
@@ -0,0 +1,30 @@
+#include "pch.h"
+#include "Random.h"
+#include <atomic>
+
+namespace jv::ai
+{
+	// Spread the bits of a seed, so that similar seeds still give unrelated sequences.
+	static uint64_t SplitMix(uint64_t& seed)
+	{
+		uint64_t z = seed += 0x9e3779b97f4a7c15;
+		z = (z ^ z >> 30) * 0xbf58476d1ce4e5b9;
+		z = (z ^ z >> 27) * 0x94d049bb133111eb;
+		return z ^ z >> 31;
+	}
+
+	Random CreateRandom(uint64_t seed)
+	{
+		Random random{};
+		random.state[0] = SplitMix(seed);
+		random.state[1] = SplitMix(seed);
+		return random;
+	}
+
+	Random& GetRandom()
+	{
+		static std::atomic<uint64_t> threadCount{ 0 };
+		thread_local Random random = CreateRandom(threadCount++);
+		return random;
+	}
+}
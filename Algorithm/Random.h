@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+
+namespace jv::ai
+{
+	// Small and fast xoroshiro128+ generator. Not thread safe, every thread should use its own.
+	struct Random final
+	{
+		uint64_t state[2];
+	};
+
+	[[nodiscard]] inline uint64_t NextRandom(Random& random)
+	{
+		const uint64_t s0 = random.state[0];
+		uint64_t s1 = random.state[1];
+		const uint64_t result = s0 + s1;
+		s1 ^= s0;
+		random.state[0] = (s0 << 24 | s0 >> 40) ^ s1 ^ s1 << 16;
+		random.state[1] = s1 << 37 | s1 >> 27;
+		return result;
+	}
+
+	// Returns a value in [0, 1).
+	[[nodiscard]] inline float RandF(Random& random)
+	{
+		return static_cast<float>(NextRandom(random) >> 40) * (1.f / 16777216.f);
+	}
+
+	[[nodiscard]] inline float RandF(Random& random, const float min, const float max)
+	{
+		return min + RandF(random) * (max - min);
+	}
+
+	// Returns a value in [0, bound).
+	[[nodiscard]] inline uint32_t RandU(Random& random, const uint32_t bound)
+	{
+		return static_cast<uint32_t>((NextRandom(random) >> 32) * bound >> 32);
+	}
+
+	__declspec(dllexport) [[nodiscard]] Random CreateRandom(uint64_t seed);
+	// Generator of the calling thread. Every thread starts with a different seed.
+	__declspec(dllexport) [[nodiscard]] Random& GetRandom();
+}
@@ -0,0 +1,97 @@
+#include "pch.h"
+#include "Selection.h"
+#include "Random.h"
+
+namespace jv::ai
+{
+	// Ties are broken by index, so that the result doesn't depend on the order of evaluation.
+	[[nodiscard]] static bool IsBetter(const float* ratings, const uint32_t a, const uint32_t b)
+	{
+		return ratings[a] > ratings[b] || (ratings[a] == ratings[b] && a < b);
+	}
+
+	// Restore a heap that has the worst index at the root.
+	static void SiftDown(const float* ratings, uint32_t* heap, const uint32_t count, uint32_t index)
+	{
+		while (true)
+		{
+			const uint32_t left = index * 2 + 1;
+			const uint32_t right = left + 1;
+			uint32_t worst = index;
+			if (left < count && IsBetter(ratings, heap[worst], heap[left]))
+				worst = left;
+			if (right < count && IsBetter(ratings, heap[worst], heap[right]))
+				worst = right;
+			if (worst == index)
+				return;
+
+			const uint32_t temp = heap[index];
+			heap[index] = heap[worst];
+			heap[worst] = temp;
+			index = worst;
+		}
+	}
+
+	void SelectTop(const float* ratings, const uint32_t length, uint32_t* indices, uint32_t k)
+	{
+		k = k < length ? k : length;
+		if (k == 0)
+			return;
+
+		// The output doubles as the heap.
+		for (uint32_t i = 0; i < k; i++)
+			indices[i] = i;
+		for (uint32_t i = k / 2; i-- > 0;)
+			SiftDown(ratings, indices, k, i);
+
+		for (uint32_t i = k; i < length; i++)
+		{
+			if (!IsBetter(ratings, i, indices[0]))
+				continue;
+			indices[0] = i;
+			SiftDown(ratings, indices, k, 0);
+		}
+
+		// Move the worst to the back until the heap is empty, which leaves the best in front.
+		for (uint32_t count = k; count > 1; count--)
+		{
+			const uint32_t temp = indices[0];
+			indices[0] = indices[count - 1];
+			indices[count - 1] = temp;
+			SiftDown(ratings, indices, count - 1, 0);
+		}
+	}
+
+	void SelectTournament(const float* ratings, const uint32_t length, uint32_t* indices, const uint32_t k,
+		const uint32_t size)
+	{
+		assert(length > 0);
+		auto& random = GetRandom();
+		for (uint32_t i = 0; i < k; i++)
+		{
+			uint32_t winner = RandU(random, length);
+			for (uint32_t j = 1; j < size; j++)
+			{
+				const uint32_t challenger = RandU(random, length);
+				winner = IsBetter(ratings, challenger, winner) ? challenger : winner;
+			}
+			indices[i] = winner;
+		}
+	}
+
+	void SelectRank(const float* ratings, const uint32_t length, uint32_t* indices, const uint32_t k,
+		const float pressure)
+	{
+		assert(length > 0);
+		assert(pressure >= 1 && pressure <= 2);
+		auto& random = GetRandom();
+		const float winChance = pressure / 2;
+		for (uint32_t i = 0; i < k; i++)
+		{
+			const uint32_t a = RandU(random, length);
+			const uint32_t b = RandU(random, length);
+			const bool aWins = IsBetter(ratings, a, b) == (RandF(random) < winChance);
+			indices[i] = aWins ? a : b;
+		}
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+
+namespace jv::ai
+{
+	enum class SelectionMode
+	{
+		// Take the highest ratings.
+		top,
+		// Take the best of a few random instances, repeated for every pick.
+		tournament,
+		// Pick with a chance that decreases linearly with the rank, without sorting.
+		rank
+	};
+
+	/*
+	Write the indices of the k highest ratings to indices, best first. Ties are won by the lowest index.
+	Keeps a heap of the best k, so it runs in O(n log k).
+	*/
+	__declspec(dllexport) void SelectTop(const float* ratings, uint32_t length, uint32_t* indices, uint32_t k);
+	/*
+	Fill indices with the winners of k tournaments between size random instances.
+	Larger tournaments increase the selection pressure. An instance can be picked more than once.
+	*/
+	__declspec(dllexport) void SelectTournament(const float* ratings, uint32_t length, uint32_t* indices, uint32_t k,
+		uint32_t size);
+	/*
+	Linear rank selection. Pressure is the expected amount of picks of the best instance relative to the average one,
+	from 1 (uniform) to 2. Done by binary tournaments that the better instance wins with a chance of pressure / 2,
+	which gives the same distribution as sorting. An instance can be picked more than once.
+	*/
+	__declspec(dllexport) void SelectRank(const float* ratings, uint32_t length, uint32_t* indices, uint32_t k,
+		float pressure);
+}